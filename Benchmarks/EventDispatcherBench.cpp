@@ -0,0 +1,136 @@
+// Invoke latency of EventDispatcher with 1, 8 and 64 subscribers, against a vector of subscribers behind a mutex,
+// which is what a multicast dispatcher costs without the copy-on-write list. Measured with no other thread and
+// with readers on every other core while one thread keeps subscribing and unsubscribing.
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "polyhook2/EventDispatcher.hpp"
+
+namespace
+{
+    constexpr uint32_t ITERATIONS = 2'000'000;
+
+    using Signature = void(uint64_t);
+
+    std::atomic<uint64_t> g_sink{0};
+
+    void subscriber(const uint64_t value)
+    {
+        g_sink.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    // the locked alternative, every Invoke takes the mutex
+    class LockedDispatcher
+    {
+    public:
+        uint64_t operator+=(const std::function<Signature>& event)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_events.push_back({m_nextId, event});
+            return m_nextId++;
+        }
+
+        void operator-=(const uint64_t id)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::erase_if(m_events, [id](const auto& entry)
+            {
+                return entry.first == id;
+            });
+        }
+
+        void Invoke(const uint64_t value) const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (const auto& entry : m_events)
+            {
+                entry.second(value);
+            }
+        }
+
+    private:
+        mutable std::mutex m_mutex;
+        std::vector<std::pair<uint64_t, std::function<Signature>>> m_events;
+        uint64_t m_nextId = 1;
+    };
+
+    template <typename Dispatcher>
+    double nsPerInvoke(const Dispatcher& dispatcher)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < ITERATIONS; i++)
+        {
+            dispatcher.Invoke(i);
+        }
+        const auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count() / ITERATIONS;
+    }
+
+    // mean ns per Invoke over all reader threads, one more thread churns the subscriber list the whole time
+    template <typename Dispatcher>
+    double nsPerInvokeContended(Dispatcher& dispatcher, const uint32_t readers)
+    {
+        std::atomic<bool> done{false};
+        std::thread writer([&]()
+        {
+            while (!done.load(std::memory_order_relaxed))
+            {
+                const uint64_t id = dispatcher += &subscriber;
+                dispatcher -= id;
+            }
+        });
+
+        std::vector<double> results(readers);
+        std::vector<std::thread> threads;
+        for (uint32_t t = 0; t < readers; t++)
+        {
+            threads.emplace_back([&, t]()
+            {
+                results[t] = nsPerInvoke(dispatcher);
+            });
+        }
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        done = true;
+        writer.join();
+
+        double total = 0;
+        for (const double result : results)
+        {
+            total += result;
+        }
+        return total / readers;
+    }
+
+    template <typename Dispatcher>
+    void bench(const char* name, const uint32_t subscribers, const uint32_t readers)
+    {
+        Dispatcher dispatcher;
+        for (uint32_t i = 0; i < subscribers; i++)
+        {
+            dispatcher += &subscriber;
+        }
+
+        const double alone = nsPerInvoke(dispatcher);
+        const double contended = readers ? nsPerInvokeContended(dispatcher, readers) : 0;
+        printf("%-16s %2u subscribers  %8.2f ns  %8.2f ns with %u readers and a writer\n", name, subscribers, alone,
+               contended, readers);
+    }
+}
+
+int main()
+{
+    const uint32_t cores = std::max(2u, std::thread::hardware_concurrency());
+    const uint32_t readers = cores - 1;
+
+    for (const uint32_t subscribers : {1u, 8u, 64u})
+    {
+        bench<LockedDispatcher>("mutex + vector", subscribers, readers);
+        bench<PLH::EventDispatcher<Signature>>("copy-on-write", subscribers, readers);
+    }
+    return (int)(g_sink.load() & 0);
+}
@@ -0,0 +1,118 @@
+// Per-call cost of ILCallback stubs by argument kind. The added cost of a stub over a direct call should stay
+// flat whether the arguments are scalars, vectors or small structs passed in registers.
+#include <chrono>
+#include <cstdio>
+#include <immintrin.h>
+
+#include "polyhook2/Detour/ILCallback.hpp"
+
+#if defined(_MSC_VER)
+#define BENCH_NOINLINE __declspec(noinline)
+#else
+#define BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+// Win64 passes vectors by reference unless vectorcall is used, ILCallback only takes them in registers
+#if defined(_WIN64)
+#define BENCH_VECCALL __vectorcall
+static const char* const VEC_CONV = "vectorcall";
+#else
+#define BENCH_VECCALL
+static const char* const VEC_CONV = "";
+#endif
+
+namespace
+{
+    constexpr uint32_t ITERATIONS = 10'000'000;
+
+    volatile double g_sink = 0;
+
+    struct Pair
+    {
+        double x;
+        int y;
+    };
+
+    BENCH_NOINLINE int scalarFn(const int a, const int b)
+    {
+        return a + b;
+    }
+
+    BENCH_NOINLINE double floatFn(const double a, const float b)
+    {
+        return a * b;
+    }
+
+    BENCH_NOINLINE float BENCH_VECCALL vec128Fn(const __m128 v)
+    {
+        return _mm_cvtss_f32(v);
+    }
+
+#if defined(__AVX__)
+    BENCH_NOINLINE double BENCH_VECCALL vec256Fn(const __m256d v)
+    {
+        return _mm256_cvtsd_f64(v);
+    }
+#endif
+
+    BENCH_NOINLINE double structFn(const Pair p)
+    {
+        return p.x + p.y;
+    }
+
+    void onCall(const PLH::ILCallback::Parameters*, const uint8_t, const PLH::ILCallback::ReturnValue*)
+    {
+    }
+
+    template <typename Fn, typename... Args>
+    double nsPerCall(Fn fn, Args... args)
+    {
+        // through a volatile pointer so the direct call stays an indirect call like the stub's
+        Fn volatile target = fn;
+        double acc = 0;
+
+        const auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < ITERATIONS; i++)
+        {
+            acc += (double)target(args...);
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        g_sink = acc;
+        return std::chrono::duration<double, std::nano>(end - start).count() / ITERATIONS;
+    }
+
+    // calls fn directly and through an Observe stub whose original is fn, prints both and the difference
+    template <typename Fn, typename... Args>
+    void bench(const char* name, const std::string& retType, const std::vector<std::string>& paramTypes,
+               const std::string& callConv, Fn fn, Args... args)
+    {
+        PLH::ILCallback callback;
+        const uint64_t stub = callback.getJitFunc(retType, paramTypes, asmjit::Environment::host().arch(), &onCall,
+                                                  callConv, PLH::ILCallback::CallbackMode::Observe);
+        if (!stub)
+        {
+            printf("%-24s stub generation failed\n", name);
+            return;
+        }
+        *callback.getTrampolineHolder() = (uint64_t)fn;
+
+        const double direct = nsPerCall(fn, args...);
+        const double stubbed = nsPerCall((Fn)stub, args...);
+        printf("%-24s direct %6.2f ns  stub %6.2f ns  added %6.2f ns\n", name, direct, stubbed, stubbed - direct);
+    }
+}
+
+int main()
+{
+    bench("int(int, int)", "int", {"int", "int"}, "", &scalarFn, 1, 2);
+    bench("double(double, float)", "double", {"double", "float"}, "", &floatFn, 1.5, 2.5f);
+    bench("float(__m128)", "float", {"__m128"}, VEC_CONV, &vec128Fn, _mm_set1_ps(1.0f));
+#if defined(__AVX__)
+    bench("double(__m256d)", "double", {"__m256d"}, VEC_CONV, &vec256Fn, _mm256_set1_pd(1.0));
+#else
+    printf("%-24s skipped, build with AVX enabled\n", "double(__m256d)");
+#endif
+    bench("double(struct{double, int})", "double", {"struct{double, int}"}, "", &structFn, Pair{1.5, 2});
+    return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef POLYHOOK_2_DECODECACHE_HPP
+#define POLYHOOK_2_DECODECACHE_HPP
+
+#include "polyhook2/PolyHookOs.hpp"
+#include "polyhook2/Enums.hpp"
+#include "polyhook2/Instruction.hpp"
+
+namespace PLH
+{
+    /**
+    Opt-in cache of ZydisDisassembler::disassemble results. Entries are keyed by the arguments
+    of the call and remember a hash of the bytes that were decoded, a hit is only served while the
+    bytes read at the same address still hash the same. Writes done through writeEncoding drop
+    the overlapping entries of every live cache right away.
+    A cache may be shared between disassemblers, e.g. all detours of a process.
+    **/
+    class DecodeCache
+    {
+    public:
+        DecodeCache();
+        ~DecodeCache();
+
+        DecodeCache(const DecodeCache&) = delete;
+        DecodeCache& operator=(const DecodeCache&) = delete;
+
+        /**Cached decode of the given bytes, if present and the bytes match what was decoded**/
+        std::optional<insts_t> lookup(uint64_t firstInstruction, uint64_t start, uint64_t end, Mode mode,
+                                      const uint8_t* bytes, size_t size);
+
+        void store(uint64_t firstInstruction, uint64_t start, uint64_t end, Mode mode, const uint8_t* bytes,
+                   size_t size, const insts_t& insts);
+
+        /**Drop every entry whose decoded bytes overlap [address, address + size)**/
+        void invalidate(uint64_t address, uint64_t size);
+
+        void clear();
+
+        /**Called for every write through ZydisDisassembler::writeEncoding, invalidates all live caches**/
+        static void notifyWrite(uint64_t address, uint64_t size);
+
+    private:
+        struct Key
+        {
+            uint64_t firstInstruction;
+            uint64_t start;
+            uint64_t end;
+            Mode mode;
+
+            bool operator==(const Key& other) const = default;
+        };
+
+        struct KeyHash
+        {
+            size_t operator()(const Key& key) const;
+        };
+
+        struct Entry
+        {
+            uint64_t hash;
+            size_t size;
+            insts_t insts;
+        };
+
+        static uint64_t hashBytes(const uint8_t* bytes, size_t size);
+
+        std::mutex m_mutex;
+        std::unordered_map<Key, Entry, KeyHash> m_entries;
+    };
+}
+#endif
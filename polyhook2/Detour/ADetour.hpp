@@ -15,6 +15,8 @@
 #include "polyhook2/Enums.hpp"
 #include "polyhook2/Misc.hpp"
 #include "polyhook2/RangeAllocator.hpp"
+#include "polyhook2/HookStats.hpp"
+#include "polyhook2/HookEvents.hpp"
 
 /**
  * All of these methods must be transactional. That
@@ -51,10 +53,42 @@ namespace PLH
             {
                 unHook();
             }
+            releaseStats();
         }
 
+        /**
+        Equivalent to prepareHook() followed by commitHook() with the patched
+        page made writable for the duration of the write.
+        **/
+        bool hook() override;
+
         virtual bool unHook() override;
 
+        /**
+        First half of hook(). Decodes the function, builds the trampoline and the hook
+        instructions, but does not touch the bytes at fnAddress. Must be followed by
+        either commitHook() or cancelHook().
+        **/
+        virtual bool prepareHook() = 0;
+
+        /**
+        Second half of hook(). Writes the prepared hook instructions over the prologue.
+        The caller is responsible for the patched range being writable.
+        **/
+        bool commitHook();
+
+        /**
+        Releases everything prepareHook() allocated. Only valid while the prologue
+        has not been patched, or after it was restored.
+        **/
+        virtual void cancelHook();
+
+        /**Address of the first byte commitHook() writes to. Valid after prepareHook()**/
+        uint64_t getPatchAddress() const;
+
+        /**Number of bytes commitHook() writes. Valid after prepareHook()**/
+        uint32_t getPatchSize() const;
+
         /**
         This is for restoring hook bytes if a 3rd party uninstalled them.
         DO NOT call this after unHook(). This may only be called after hook()
@@ -75,7 +109,22 @@ namespace PLH
 
         void setIsFollowCallOnFnAddress(bool value);
 
+        /**Share decoded instructions between detours, see DecodeCache. nullptr disables caching**/
+        void setDecodeCache(std::shared_ptr<DecodeCache> cache);
+
+        /**
+        Instrument calls through the hook, see HookStats. Must be set before the hook is first prepared,
+        with Off (the default) the hook jumps straight to the callback and costs nothing extra.
+        **/
+        void setStatsMode(StatsMode mode);
+
+        /**nullptr unless the hook was prepared with a stats mode other than Off**/
+        const HookStats* getStats() const;
+
     protected:
+        // publishes the Install events of the detours it commits
+        friend class DetourBatch;
+
         uint64_t m_fnAddress;
         uint64_t m_fnCallback;
         uint64_t* m_userTrampVar;
@@ -94,6 +143,29 @@ namespace PLH
         uint32_t m_hookSize = 0;
         bool m_isFollowCallOnFnAddress = true; // whether follow 'CALL' destination
 
+        StatsMode m_statsMode = StatsMode::Off;
+        std::unique_ptr<HookStats> m_stats;
+        uint64_t m_statsThunk = 0; // entry thunk, the exit thunk lives in the same block
+
+        /**Build the instrumentation thunk for the stats mode, kept until the detour is destroyed since
+        calls may still be returning through it after unHook**/
+        bool prepareStats();
+
+        void releaseStats();
+
+        /**Where the hook jumps to, the stats thunk or the callback**/
+        uint64_t getHookDestination() const;
+
+        /**Scheme reported in HookEvents, for detours that choose between several**/
+        virtual uint8_t getChosenScheme() const
+        {
+            return 0;
+        }
+
+        /**Publishes to HookEvents, a no-op when start is empty because nobody was subscribed**/
+        void publishEvent(HookEvent::Kind kind, bool success, const HookEvents::Start& start,
+                          uint64_t trampoline) const;
+
         /**Walks the given vector of instructions and sets roundedSz to the lowest size possible that doesn't split any instructions and is greater than minSz.
         If end of function is encountered before this condition an empty optional is returned. Returns instructions in the range start to adjusted end**/
         static std::optional<insts_t> calcNearestSz(const insts_t& functionInsts, uint64_t minSz, uint64_t& roundedSz);
@@ -0,0 +1,60 @@
+#ifndef POLYHOOK_2_CODECAVEINDEX_HPP
+#define POLYHOOK_2_CODECAVEINDEX_HPP
+
+#include "polyhook2/PolyHookOs.hpp"
+#include "polyhook2/MemAccessor.hpp"
+#include "polyhook2/MemRegionMap.hpp"
+
+namespace PLH
+{
+    /**
+     * Process wide index of code caves: runs of int3 (0xCC) or nop (0x90) padding directly
+     * after a ret / retn. Executable memory is scanned once, the first time a request touches
+     * it, and the free caves are kept sorted by address so the cave nearest to a target is found
+     * with a tree lookup instead of rescanning the +-2GB window per hook. Handed out caves are
+     * removed from the index until they are released.
+     **/
+    class CodeCaveIndex
+    {
+    public:
+        // shorter padding runs are not recorded, 8 bytes is what a 64bit destination holder needs
+        static constexpr uint32_t MIN_CAVE_SIZE = 8;
+
+        static CodeCaveIndex& singleton();
+
+        /**Consume the free cave nearest to target that is at least size bytes and lies in [min, max)**/
+        std::optional<uint64_t> acquire(uint64_t target, uint32_t size, uint64_t min, uint64_t max,
+                                        const MemAccessor& accessor);
+
+        /**Reserve a cave found without the index, false if part of it is already handed out**/
+        bool claim(uint64_t address, uint32_t size);
+
+        /**Return a cave previously handed out by acquire or claim**/
+        void release(uint64_t address, uint32_t size);
+
+        /**Forget all caves and scanned regions, e.g. after modules were unloaded**/
+        void clear();
+
+    private:
+        CodeCaveIndex() = default;
+
+        // must hold m_mutex
+        void scanRange(uint64_t start, uint64_t end, const MemAccessor& accessor);
+        void markScanned(uint64_t start, uint64_t end);
+        void insertCave(uint64_t start, uint64_t length);
+
+        std::mutex m_mutex;
+
+        // start -> length of every free cave
+        std::map<uint64_t, uint64_t> m_caves;
+
+        // start -> length of every cave handed out
+        std::map<uint64_t, uint64_t> m_used;
+
+        // start -> end of the disjoint, non adjacent address ranges already scanned. Ranges not
+        // mappings, protection changes split and merge mappings without changing their contents
+        std::map<uint64_t, uint64_t> m_scanned;
+    };
+}
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef POLYHOOK_2_DETOURBATCH_HPP
+#define POLYHOOK_2_DETOURBATCH_HPP
+
+#include "polyhook2/PolyHookOs.hpp"
+#include "polyhook2/Detour/ADetour.hpp"
+#include "polyhook2/MemAccessor.hpp"
+#include "polyhook2/Enums.hpp"
+
+namespace PLH
+{
+    /**
+     * Installs many detours at once. Every detour is prepared first (disassembly, trampoline,
+     * hook instructions), then the prologues are grouped by page so each run of pages is made
+     * writable exactly once, all prologues are patched, and the protections are restored.
+     *
+     * A detour that fails to prepare is reported, releases what it claimed and is skipped, the
+     * rest are still installed. Page runs are cut at mapping boundaries so every run is restored
+     * to its own protection. Page protection and patching are all-or-nothing: if any page run
+     * can't be made writable or any prologue fails to patch, the prologues already patched are
+     * restored and every prepared detour is rolled back.
+     *
+     * Detours are not owned by the batch and must outlive the call to commit().
+     **/
+    class DetourBatch : public MemAccessor
+    {
+    public:
+        enum class Status
+        {
+            Pending,
+            Hooked,
+            PrepareFailed, // the detour itself failed to decode/relocate/allocate
+            Overlapping, // prologue overlaps one patched by an earlier entry of this batch
+            ProtectFailed, // a page run could not be made writable, whole batch rolled back
+            CommitFailed // a prologue could not be patched, whole batch rolled back
+        };
+
+        struct Entry
+        {
+            Detour* detour;
+            Status status;
+        };
+
+        DetourBatch() = default;
+        ~DetourBatch() override = default;
+
+        void add(Detour& detour);
+
+        /**Install every pending detour. Returns the number of detours hooked by this call**/
+        size_t commit();
+
+        const std::vector<Entry>& getEntries() const;
+
+        void clear();
+
+    private:
+        struct PageRun
+        {
+            uint64_t start;
+            uint64_t size;
+            ProtFlag origProt;
+        };
+
+        void rollback(const std::vector<Entry*>& prepared, Status status);
+
+        // writes the original prologues back over detours committed by this batch, pages must be writable
+        static void uncommit(const std::vector<Entry*>& committed);
+
+        std::vector<Entry> m_entries;
+    };
+}
+
+#endif
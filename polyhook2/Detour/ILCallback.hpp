@@ -31,7 +31,9 @@ namespace PLH {
 		private:
 			// must be char* for aliasing rules to work when reading back out
 			char* getArgPtr(const uint8_t idx) const {
-				return ((char*)&m_arguments) + sizeof(uint64_t) * idx;
+				// slots vary in width (vectors, structs), the stub keeps its offset table just in front of them
+				const uint16_t* offsets = *(const uint16_t* const*)(((char*)&m_arguments) - sizeof(uint64_t));
+				return ((char*)&m_arguments) + offsets[idx];
 			}
 		};
 
@@ -44,30 +46,178 @@ namespace PLH {
 
 		typedef void(*tUserCallback)(const Parameters* params, const uint8_t count, const ReturnValue* ret);
 
+		/* What the stub does around the original function. Cheaper modes generate less code per hooked call.
+		Modify:  callback runs first, written back arguments and the ReturnValue it sets are used.
+		Observe: callback runs first and only reads, arguments are forwarded untouched and the original's return is passed through.
+		PrePost: like Modify, then the original's return value is stored in ReturnValue and the post callback runs before returning it.*/
+		enum class CallbackMode : uint8_t {
+			Modify,
+			Observe,
+			PrePost
+		};
+
+		// return type, argument types and signature of a function type Ret(Args...)
+		template<typename Fn>
+		struct FnTraits;
+
+		template<typename Ret, typename... Args>
+		struct FnTraits<Ret(Args...)> {
+			using ReturnType = Ret;
+			using ArgTypes = std::tuple<Args...>;
+
+			// the stub moves every value through one 64bit gp or xmm register
+			template<typename T>
+			static constexpr bool fitsSlot = (std::is_arithmetic_v<T> || std::is_pointer_v<T>) && sizeof(T) <= sizeof(uint64_t);
+			static constexpr bool supported = (fitsSlot<Args> && ...) && (std::is_void_v<Ret> || fitsSlot<Ret>);
+
+			static asmjit::FuncSignature signature(const asmjit::CallConvId callConv) {
+				return asmjit::FuncSignatureT<Ret, Args...>(callConv);
+			}
+		};
+
+		/* Typed view of the Parameters of a callback for Fn, e.g. ParametersT<int(int, float)>. Argument I
+		is in slot I of the stub's argument area, so its offset is a constant and the index is checked at compile time.*/
+		template<typename Fn>
+		struct ParametersT;
+
+		template<typename Ret, typename... Args>
+		struct ParametersT<Ret(Args...)> {
+			static constexpr uint8_t count = sizeof...(Args);
+
+			template<size_t I>
+			using ArgT = std::tuple_element_t<I, std::tuple<Args...>>;
+
+			template<size_t I>
+			static constexpr size_t offset = sizeof(uint64_t) * I;
+
+			explicit ParametersT(const Parameters* params) : m_params(params) {}
+
+			template<size_t I>
+			ArgT<I> get() const {
+				ArgT<I> val;
+				memcpy(&val, slot<I>(), sizeof(val));
+				return val;
+			}
+
+			template<size_t I>
+			void set(const ArgT<I> val) const {
+				memcpy(slot<I>(), &val, sizeof(val));
+			}
+
+		private:
+			template<size_t I>
+			char* slot() const {
+				static_assert(I < count, "Argument index out of range");
+				return ((char*)&m_params->m_arguments) + offset<I>;
+			}
+
+			const Parameters* m_params;
+		};
+
+		// typed view of the ReturnValue, set has no effect on the caller for void functions
+		template<typename Ret>
+		struct ReturnValueT {
+			explicit ReturnValueT(const ReturnValue* ret) : m_ret(ret) {}
+
+			template<typename T = Ret> requires (!std::is_void_v<T>)
+			T get() const {
+				T val;
+				memcpy(&val, m_ret->getRetPtr(), sizeof(val));
+				return val;
+			}
+
+			template<typename T = Ret> requires (!std::is_void_v<T>)
+			void set(const T val) const {
+				memcpy(m_ret->getRetPtr(), &val, sizeof(val));
+			}
+
+		private:
+			const ReturnValue* m_ret;
+		};
+
 		ILCallback();
 		~ILCallback();
 
+		// owns its stub, copies would free it twice
+		ILCallback(const ILCallback&) = delete;
+		ILCallback& operator=(const ILCallback&) = delete;
+
 		/* Construct a callback given the raw signature at runtime. 'Callback' param is the C stub to transfer to,
 		where parameters can be modified through a structure which is written back to the parameter slots depending
-		on calling convention.*/
-		uint64_t getJitFunc(const asmjit::FuncSignature& sig, const asmjit::Arch arch, const tUserCallback callback);
+		on calling convention. Calling any getJitFunc again builds a new stub; the earlier ones stay valid, since a
+		detour may still jump to them, and are all freed when the ILCallback is destroyed. Every stub shares the one
+		trampoline holder.*/
+		uint64_t getJitFunc(const asmjit::FuncSignature& sig, const asmjit::Arch arch, const tUserCallback callback,
+			const CallbackMode mode = CallbackMode::Modify, const tUserCallback postCallback = nullptr);
 
 		/* Construct a callback given the typedef as a string. Types are any valid C/C++ data type (basic types), and pointers to
 		anything are just a uintptr_t. Calling convention is defaulted to whatever is typical for the compiler you use, you can override with
-		stdcall, fastcall, or cdecl (cdecl is default on x86). On x64 those map to the same thing.*/
-		uint64_t getJitFunc(const std::string& retType, const std::vector<std::string>& paramTypes, const asmjit::Arch arch, const tUserCallback callback, std::string callConv = "");
+		stdcall, fastcall, vectorcall or cdecl (cdecl is default on x86). On x64 those map to the same thing except vectorcall.
+		On x64 __m128(i/d) and __m256(i/d) are passed in registers (Win64 only with vectorcall). Small structs by value are
+		written as their field types, e.g. "struct{double, int}", and read back whole with getArg<T>. On Win64 structs that
+		aren't 1, 2, 4 or 8 bytes are passed by reference so their slot holds a pointer.*/
+		uint64_t getJitFunc(const std::string& retType, const std::vector<std::string>& paramTypes, const asmjit::Arch arch, const tUserCallback callback, std::string callConv = "",
+			const CallbackMode mode = CallbackMode::Modify, const tUserCallback postCallback = nullptr);
+
+		/* Construct a callback for the function type Fn, e.g. make<int(int, float), &onCall>(). The signature is
+		derived at compile time and Callback is called as Callback(const ParametersT<Fn>&, const ReturnValueT<Ret>&),
+		so there is no type string parsing and no unchecked casts. Host arch only since the types are host types.*/
+		template<typename Fn, auto Callback>
+		uint64_t make(const asmjit::CallConvId callConv = asmjit::CallConvId::kHost) {
+			return make<Fn>(&typedCallbackAdapter<Fn, Callback>, callConv);
+		}
+
+		// same with an untyped callback
+		template<typename Fn>
+		uint64_t make(const tUserCallback callback, const asmjit::CallConvId callConv = asmjit::CallConvId::kHost,
+			const CallbackMode mode = CallbackMode::Modify, const tUserCallback postCallback = nullptr) {
+			static_assert(FnTraits<Fn>::supported, "Only integer, pointer and floating point types up to 64bits are supported");
+			return getJitFunc(FnTraits<Fn>::signature(callConv), asmjit::Environment::host().arch(), callback, mode, postCallback);
+		}
+
 		uint64_t* getTrampolineHolder();
 	private:
+		template<typename Fn, auto Callback>
+		static void typedCallbackAdapter(const Parameters* params, const uint8_t count, const ReturnValue* ret) {
+			(void)count;
+			Callback(ParametersT<Fn>(params), ReturnValueT<typename FnTraits<Fn>::ReturnType>(ret));
+		}
+
 		// does a given type fit in a general purpose register (i.e. is it integer type)
 		bool isGeneralReg(const asmjit::TypeId typeId) const;
-		// float, double, simd128
+		// float, double
 		bool isXmmReg(const asmjit::TypeId typeId) const;
+		// __m128, __m256 and friends
+		bool isVecReg(const asmjit::TypeId typeId) const;
+
+		// registers a struct given as "struct{field, ...}" is passed in, false if it goes on the stack
+		bool classifyStruct(const std::string& type, const asmjit::Arch arch, std::vector<asmjit::TypeId>& parts) const;
+
+		/* argGroups maps each argument of sig to the parameter it is part of, structs are split over registers.
+		Empty when every parameter is a single argument.*/
+		uint64_t makeJitFunc(const asmjit::FuncSignature& sig, const std::vector<uint8_t>& argGroups, const asmjit::Arch arch,
+			const tUserCallback callback, const CallbackMode mode, const tUserCallback postCallback);
+
+		// free every stub handed out, the hooks using them must be gone
+		void releaseJitFunc();
 
 		asmjit::CallConvId getCallConv(const std::string& conv);
 		asmjit::TypeId getTypeId(const std::string& type);
 
+		// compiled stub for one signature shape, built on first use and shared by all callbacks of that shape
+		struct StubTemplate;
+		std::shared_ptr<const StubTemplate> getStubTemplate(const asmjit::FuncSignature& sig, const std::vector<uint8_t>& argGroups,
+			const asmjit::Arch arch, const CallbackMode mode) const;
+		bool compileStubTemplate(const asmjit::FuncSignature& sig, const std::vector<uint8_t>& argGroups, const asmjit::Arch arch,
+			const CallbackMode mode, StubTemplate& stub) const;
+
+		static std::mutex m_stubTemplatesMutex;
+		static std::unordered_map<std::string, std::shared_ptr<const StubTemplate>> m_stubTemplates;
+
 		uint64_t m_callbackBuf;
-		asmjit::x86::Mem argsStack;
+
+		// stubs replaced by a later getJitFunc, freed with the current one
+		std::vector<uint64_t> m_retiredStubs;
 
 		// ptr to trampoline allocated by hook, we hold this so user doesn't need to.
 		uint64_t m_trampolinePtr;
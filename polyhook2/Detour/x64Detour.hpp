@@ -11,7 +11,7 @@
 #include "polyhook2/Instruction.hpp"
 #include "polyhook2/ZydisDisassembler.hpp"
 #include "polyhook2/ErrorLog.hpp"
-#include "polyhook2/RangeAllocator.hpp"
+#include "polyhook2/NearCodeHeap.hpp"
 #include <asmjit/asmjit.h>
 
 namespace PLH {
@@ -36,9 +36,9 @@ public:
 
     ~x64Detour() override;
 
-    bool hook() override;
+    bool prepareHook() override;
 
-    bool unHook() override;
+    void cancelHook() override;
 
     Mode getArchType() const override;
 
@@ -53,11 +53,14 @@ public:
 protected:
     detour_scheme_t m_detourScheme = detour_scheme_t::RECOMMENDED; // this is the most stable configuration.
     optional<uint64_t> m_valloc2_region;
-    RangeAllocator m_allocator;
+    optional<uint64_t> m_code_cave; // cave handed out by CodeCaveIndex, returned on unhook
+    bool m_nearTrampoline = false; // m_trampoline is from NearCodeHeap rather than the asmjit runtime
     detour_scheme_t m_chosen_scheme = detour_scheme_t::VALLOC2;
 
     bool makeTrampoline(insts_t& prologue, insts_t& outJmpTable);
 
+    uint8_t getChosenScheme() const override;
+
     // assumes we are looking within a +-2GB window
     template<uint16_t SIZE>
     optional<uint64_t> findNearestCodeCave(uint64_t address);
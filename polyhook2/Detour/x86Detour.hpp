@@ -21,7 +21,7 @@ public:
 
     virtual ~x86Detour() = default;
 
-    virtual bool hook() override;
+    virtual bool prepareHook() override;
 
     Mode getArchType() const override;
 
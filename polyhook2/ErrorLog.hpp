@@ -8,6 +8,26 @@
 
 namespace PLH
 {
+    // fixed size log record, hook installs emit these instead of building prose
+    struct LogEvent
+    {
+        enum class Kind : uint8_t
+        {
+            Message, // free text in msg, truncated
+            HookPrepared, // address = hooked function, arg0 = detour scheme (0 if the arch has none), arg1 = patch size
+            TrampolineBuilt, // address = trampoline, arg0 = trampoline size, arg1 = hooked function
+        };
+
+        Kind kind = Kind::Message;
+        ErrorLevel level = ErrorLevel::INFO;
+        uint64_t address = 0;
+        uint64_t arg0 = 0;
+        uint64_t arg1 = 0;
+        char msg[96] = {};
+
+        std::string toString() const;
+    };
+
     // abstract base class for logging, clients should subclass this to intercept log messages
     class Logger
     {
@@ -15,6 +35,9 @@ namespace PLH
         // copy
         virtual void log(const std::string& msg, ErrorLevel level) = 0;
 
+        // structured events are formatted into log() unless the logger keeps them binary
+        virtual void logEvent(const LogEvent& event);
+
         virtual ~Logger()
         {
         };
@@ -24,10 +47,21 @@ namespace PLH
     class Log
     {
         static std::shared_ptr<Logger> m_logger;
+        static std::atomic<ErrorLevel> m_level;
 
     public:
         static void registerLogger(std::shared_ptr<Logger> logger);
+
+        /**Messages below level are dropped before they are built, see PLH_LOG**/
+        static void setLogLevel(ErrorLevel level);
+
+        static bool isEnabled(const ErrorLevel level)
+        {
+            return m_logger && level >= m_level.load(std::memory_order_relaxed);
+        }
+
         static void log(std::string msg, ErrorLevel level);
+        static void logEvent(const LogEvent& event);
     };
 
     // simple logger implementation
@@ -41,6 +75,9 @@ namespace PLH
     class ErrorLog : public Logger
     {
     public:
+        // oldest errors are dropped past this many
+        static constexpr size_t MAX_ERRORS = 1024;
+
         void setLogLevel(ErrorLevel level);
 
         //copy
@@ -53,15 +90,82 @@ namespace PLH
         static ErrorLog& singleton();
 
     private:
-        std::vector<Error> m_log;
+        std::deque<Error> m_log;
         ErrorLevel m_logLevel = ErrorLevel::INFO;
     };
+
+    /**
+     * Logger that never blocks the thread logging. Events are copied into a bounded lock-free ring
+     * and a background thread drains them into the sink. When the ring is full events are dropped
+     * and counted rather than waited for. Text messages are truncated to LogEvent::msg.
+     **/
+    class RingBufferLogger : public Logger
+    {
+    public:
+        // capacity is rounded up to a power of two
+        explicit RingBufferLogger(std::shared_ptr<Logger> sink, size_t capacity = 1024);
+
+        // drains what is left and stops the thread
+        ~RingBufferLogger() override;
+
+        RingBufferLogger(const RingBufferLogger&) = delete;
+        RingBufferLogger& operator=(const RingBufferLogger&) = delete;
+
+        void log(const std::string& msg, ErrorLevel level) override;
+
+        void logEvent(const LogEvent& event) override;
+
+        /**Events lost to a full ring**/
+        uint64_t getDropped() const;
+
+    private:
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            LogEvent event;
+        };
+
+        bool tryPush(const LogEvent& event);
+        bool tryPop(LogEvent& event);
+        void drain();
+
+        std::unique_ptr<Cell[]> m_cells;
+        size_t m_mask;
+
+        // producers and the consumer each own a cache line
+        alignas(64) std::atomic<size_t> m_enqueuePos{0};
+        alignas(64) std::atomic<size_t> m_dequeuePos{0};
+        alignas(64) std::atomic<uint64_t> m_dropped{0};
+        std::atomic<bool> m_stop{false};
+
+        std::shared_ptr<Logger> m_sink;
+        std::thread m_drainThread;
+    };
 }
 
-#define PLH_LOG(...) PLH::Log::log(__VA_ARGS__)
+// msg is only evaluated when a logger is registered and level passes the filter
+#define PLH_LOG(msg, level) \
+    do { if (PLH::Log::isEnabled(level)) { PLH::Log::log(msg, level); } } while (0)
+
+#define PLH_LOG_EVENT(eventKind, eventLevel, eventAddress, eventArg0, eventArg1) \
+    do { \
+        if (PLH::Log::isEnabled(eventLevel)) \
+        { \
+            PLH::LogEvent plhEvent{}; \
+            plhEvent.kind = eventKind; \
+            plhEvent.level = eventLevel; \
+            plhEvent.address = (uint64_t)(eventAddress); \
+            plhEvent.arg0 = (uint64_t)(eventArg0); \
+            plhEvent.arg1 = (uint64_t)(eventArg1); \
+            PLH::Log::logEvent(plhEvent); \
+        } \
+    } while (0)
+
+#else
+
+#define PLH_LOG(msg, level)
+#define PLH_LOG_EVENT(eventKind, eventLevel, eventAddress, eventArg0, eventArg1)
 
 #endif
 
-#define PLH_LOG(...)
-
 #endif
@@ -1,35 +1,156 @@
 #pragma once
 
 #include "polyhook2/PolyHookOs.hpp"
+#include "polyhook2/Misc.hpp"
 
 namespace PLH
 {
+    /**
+     * Multicast event. Subscribers live in an immutable array that += and -= replace copy-on-write under a
+     * mutex, Invoke only loads the current array and walks it so it never locks or allocates and is safe
+     * from exception handlers. A replaced array is freed by the first writer that finds no Invoke running.
+     **/
     template <typename T>
     class EventDispatcher
     {
     public:
         using Event = std::function<T>;
-        void operator+=(const Event& event);
 
+        EventDispatcher() = default;
+        EventDispatcher(const EventDispatcher&) = delete;
+        EventDispatcher& operator=(const EventDispatcher&) = delete;
+
+        ~EventDispatcher()
+        {
+            delete m_list.load();
+            for (const List* retired : m_retired)
+            {
+                delete retired;
+            }
+        }
+
+        /**Returns an id for -=**/
+        uint64_t operator+=(const Event& event);
+
+        void operator-=(uint64_t id);
+
+        /**
+         * Calls subscribers in the order they were added. With a void result all of them run, otherwise
+         * the first result that tests true is returned and the rest are skipped, so a bool event means
+         * "handled". A default constructed result is returned when nobody handled it.
+         **/
         template <typename... Args>
-        typename Event::result_type Invoke(Args&&... Params)
+        typename Event::result_type Invoke(Args&&... Params) const
         {
-            assert(m_Event);
-            return m_Event(std::forward<Args>(Params)...);
+            using Result = typename Event::result_type;
+
+            // seq_cst on both so a writer that sees no readers also sees no one holding its old list
+            m_readers.fetch_add(1);
+            auto leave = finally([this]()
+            {
+                m_readers.fetch_sub(1);
+            });
+
+            // the last subscriber may have just left, callers checking operator bool first can still get here
+            const List* list = m_list.load();
+            if (!list)
+                return Result();
+
+            if constexpr (std::is_void_v<Result>)
+            {
+                for (const Entry& entry : *list)
+                {
+                    entry.event(Params...);
+                }
+            }
+            else
+            {
+                for (const Entry& entry : *list)
+                {
+                    if (Result result = entry.event(Params...))
+                        return result;
+                }
+                return Result();
+            }
         }
 
         operator bool() const
         {
-            return m_Event != nullptr;
+            return m_list.load(std::memory_order_acquire) != nullptr;
         }
 
     private:
-        Event m_Event;
+        struct Entry
+        {
+            uint64_t id;
+            Event event;
+        };
+
+        using List = std::vector<Entry>;
+
+        // must hold m_writeMutex
+        void replace(const List* list);
+
+        std::atomic<const List*> m_list{nullptr};
+        mutable std::atomic<uint32_t> m_readers{0};
+
+        std::mutex m_writeMutex;
+        std::vector<const List*> m_retired;
+        uint64_t m_nextId = 1;
     };
 
     template <typename T>
-    void EventDispatcher<T>::operator+=(const Event& event)
+    uint64_t EventDispatcher<T>::operator+=(const Event& event)
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+
+        const List* current = m_list.load();
+        auto* list = current ? new List(*current) : new List();
+        const uint64_t id = m_nextId++;
+        list->push_back({id, event});
+        replace(list);
+        return id;
+    }
+
+    template <typename T>
+    void EventDispatcher<T>::operator-=(const uint64_t id)
     {
-        m_Event = event;
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+
+        const List* current = m_list.load();
+        if (!current)
+            return;
+
+        auto* list = new List();
+        std::copy_if(current->begin(), current->end(), std::back_inserter(*list), [id](const Entry& entry)
+        {
+            return entry.id != id;
+        });
+
+        if (list->empty())
+        {
+            delete list;
+            list = nullptr;
+        }
+        replace(list);
+    }
+
+    template <typename T>
+    void EventDispatcher<T>::replace(const List* list)
+    {
+        if (const List* old = m_list.exchange(list))
+        {
+            m_retired.push_back(old);
+        }
+
+        // readers that start from here on only see the new list, so nothing retired is in use anymore
+        if (m_readers.load() == 0)
+        {
+            for (const List* retired : m_retired)
+            {
+                delete retired;
+            }
+            m_retired.clear();
+        }
     }
 }
@@ -1,7 +1,7 @@
 // https://www.codeproject.com/Articles/1272619/A-Fixed-Block-Memory-Allocator-in-C
 //
-// The fb_allocator is a fixed block memory allocator that handles a 
-// single block size. 
+// Block size helpers left from the C fb_allocator. The fixed block allocator
+// itself is PLH::FBAllocator in RangeAllocator.hpp.
 //
 
 
@@ -11,28 +11,6 @@
 #include "polyhook2/PolyHookOs.hpp"
 #include "MemAccessor.hpp"
 
-using ALLOC_HANDLE = void*;
-
-using ALLOC_Block = struct
-{
-    void* pNext;
-};
-
-using ALLOC_Allocator = struct
-{
-    const char* name;
-    const char* pPool;
-    const size_t objectSize;
-    const size_t blockSize;
-    const uint32_t maxBlocks;
-    ALLOC_Block* pHead;
-    uint16_t poolIndex;
-    uint16_t blocksInUse;
-    uint16_t maxBlocksInUse;
-    uint16_t allocations;
-    uint16_t deallocations;
-};
-
 // Align fixed blocks on X-byte boundary based on CPU architecture.
 // Set value to 1, 2, 4 or 8.
 #define ALLOC_MEM_ALIGN   (1)
@@ -41,23 +19,8 @@ using ALLOC_Allocator = struct
 #define ALLOC_MAX(a,b) (((a)>(b))?(a):(b))
 
 // Ensure the memory block size is: (a) is aligned on desired boundary and (b) at
-// least the size of a ALLOC_Allocator*. 
+// least the size of a pointer. 
 #define ALLOC_BLOCK_SIZE(_size_) \
-    (ALLOC_MAX((MEMORY_ROUND_UP(_size_, ALLOC_MEM_ALIGN)), sizeof(ALLOC_Allocator*)))
-
-// Defines block memory, allocator instance and a handle. On the example below, 
-// the ALLOC_Allocator instance is myAllocatorObj and the handle is myAllocator.
-// _name_ - the allocator name
-// _size_ - fixed memory block size in bytes
-// _objects_ - number of fixed memory blocks 
-// e.g. ALLOC_DEFINE(myAllocator, 32, 10)
-#define ALLOC_DEFINE(_name_, _size_, _objects_) \
-    static char _name_##Memory[ALLOC_BLOCK_SIZE(_size_) * (_objects_)] = { 0 }; \
-    static ALLOC_Allocator _name_##Obj = { #_name_, _name_##Memory, _size_, \
-        ALLOC_BLOCK_SIZE(_size_), _objects_, NULL, 0, 0, 0, 0, 0 }; \
-    static ALLOC_HANDLE _name_ = &_name_##Obj;
+    (ALLOC_MAX((MEMORY_ROUND_UP(_size_, ALLOC_MEM_ALIGN)), sizeof(void*)))
 
-void* ALLOC_Alloc(ALLOC_HANDLE hAlloc, size_t size);
-void* ALLOC_Calloc(ALLOC_HANDLE hAlloc, size_t num, size_t size);
-void ALLOC_Free(ALLOC_HANDLE hAlloc, void* pBlock);
 #endif  // _FB_ALLOCATOR_H
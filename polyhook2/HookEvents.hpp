@@ -0,0 +1,61 @@
+#ifndef POLYHOOK_2_HOOKEVENTS_HPP
+#define POLYHOOK_2_HOOKEVENTS_HPP
+
+#include "polyhook2/PolyHookOs.hpp"
+#include "polyhook2/Enums.hpp"
+#include "polyhook2/EventDispatcher.hpp"
+
+namespace PLH
+{
+    /**One step in the life of a hook, published to every HookEvents subscriber**/
+    struct HookEvent
+    {
+        enum class Kind : uint8_t
+        {
+            Install,
+            Uninstall,
+            Rehook
+        };
+
+        Kind kind = Kind::Install;
+        bool success = false;
+        HookType type = HookType::UNKNOWN;
+        uint64_t fnAddress = 0; // hooked function, the object for vtable hooks
+        uint8_t scheme = 0; // x64Detour::detour_scheme_t, 0 where there is no choice
+        uint32_t prologueSize = 0; // bytes patched over the function, virtual function count for vtable hooks
+        uint64_t trampoline = 0; // detour trampoline, the vtable now in use for vtable hooks
+        uint64_t durationNs = 0;
+    };
+
+    /**Process wide stream of HookEvents for telemetry, subscribers run on the thread doing the hook operation**/
+    class HookEvents
+    {
+    public:
+        using Subscriber = std::function<void(const HookEvent&)>;
+        using Start = std::optional<std::chrono::steady_clock::time_point>;
+
+        static HookEvents& singleton();
+
+        /**Returns an id for unsubscribe**/
+        uint64_t subscribe(const Subscriber& subscriber);
+
+        void unsubscribe(uint64_t id);
+
+        bool hasSubscribers() const;
+
+        void publish(const HookEvent& event) const;
+
+        /**Timestamp for the timed publish, empty without subscribers so unobserved hooks never read the clock**/
+        Start startTiming() const;
+
+        /**Fill in durationNs since start and publish, does nothing for an empty start**/
+        void publish(HookEvent event, const Start& start) const;
+
+    private:
+        HookEvents() = default;
+
+        EventDispatcher<void(const HookEvent&)> m_dispatcher;
+    };
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef POLYHOOK_2_HOOKSTATS_HPP
+#define POLYHOOK_2_HOOKSTATS_HPP
+
+#include "polyhook2/PolyHookOs.hpp"
+
+namespace PLH
+{
+    /**What a detour records about the calls going through it, see Detour::setStatsMode**/
+    enum class StatsMode : uint8_t
+    {
+        Off, // nothing is generated, the hook jumps straight to the callback
+        Count, // a locked increment per call, the return address is left alone
+        Latency // Count plus rdtsc at entry and return, feeds the histogram, see HookStats for the caveats
+    };
+
+    /**
+     * Per-hook counters written by the detour's instrumentation thunk. The call counter and the latency
+     * data each sit on their own cache line so hooks, and the hot counter and its readers, don't false share.
+     * Latency is measured in TSC ticks from entering the hook to the hooked function returning to its caller,
+     * by rewriting the return address. The exit thunk has no unwind info, so a C++ exception thrown through a
+     * sampled function terminates the process, and longjmp past it corrupts the per-thread sample stack. Only
+     * use Latency on functions that always return normally; Count never touches the return address and is safe
+     * everywhere. Stack walks see the exit thunk as the caller. Calls nested deeper than the per-thread sample
+     * stack are counted but not timed. Once a Latency thunk is generated it and its HookStats are kept for the
+     * life of the process, since calls in flight still return through the exit thunk after the hook is gone.
+     **/
+    class alignas(64) HookStats
+    {
+    public:
+        // bucket i counts samples of bit_width(ticks) == i, i.e. [2^(i-1), 2^i) ticks, the last one also everything above
+        static constexpr size_t BUCKETS = 64;
+
+        uint64_t getCalls() const;
+
+        /**Number of calls that returned and were timed**/
+        uint64_t getSamples() const;
+
+        uint64_t getTotalTicks() const;
+
+        uint64_t getBucket(size_t bucket) const;
+
+        std::array<uint64_t, BUCKETS> getHistogram() const;
+
+        void reset();
+
+        /**Called by the entry thunk, pushes a sample and points *returnSlot at the exit thunk**/
+        static void enter(HookStats* stats, uintptr_t* returnSlot);
+
+        /**Called by the exit thunk, records the sample and hands back the real return address**/
+        static uintptr_t leave();
+
+    private:
+        friend class Detour;
+
+        // the thunk increments this in place
+        std::atomic<uint64_t> m_calls{0};
+        static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+        alignas(64) std::atomic<uint64_t> m_samples{0};
+        std::atomic<uint64_t> m_totalTicks{0};
+        std::array<std::atomic<uint64_t>, BUCKETS> m_histogram{};
+
+        uintptr_t m_exitThunk = 0;
+    };
+}
+
+#endif
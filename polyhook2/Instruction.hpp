@@ -5,6 +5,8 @@
 #ifndef POLYHOOK_2_0_INSTRUCTION_HPP
 #define POLYHOOK_2_0_INSTRUCTION_HPP
 
+#include <Zydis/Zydis.h>
+
 #include "polyhook2/PolyHookOs.hpp"
 #include "polyhook2/UID.hpp"
 #include "polyhook2/Enums.hpp"
@@ -14,9 +16,19 @@
 
 namespace PLH
 {
+    /**ZydisMnemonic for a mnemonic string such as "jmp", ZYDIS_MNEMONIC_INVALID if there is none**/
+    ZydisMnemonic mnemonicFromString(const std::string& mnemonic);
+
+    /**A decoded or hand written instruction. Kept as a flat record with the bytes inline and no owning
+    * members, so copies of instruction vectors are plain memory copies and never touch the heap.
+    * Text (getMnemonic, getFullName) is produced on demand from the mnemonic id and the bytes.
+    **/
     class Instruction
     {
     public:
+        /**Longest valid x86/x64 encoding**/
+        static constexpr size_t MAX_SIZE = 15;
+
         union Displacement
         {
             int64_t Relative;
@@ -40,8 +52,8 @@ namespace PLH
                     const std::string& opStr,
                     Mode mode)
         {
-            Init(address, displacement, displacementOffset, isRelative, isIndirect, bytes, mnemonic, opStr, false,
-                 false, mode);
+            Init(address, displacement, displacementOffset, isRelative, isIndirect, bytes.data(), bytes.size(), mnemonic,
+                 opStr, false, false, mode);
         }
 
         Instruction(uint64_t address,
@@ -55,9 +67,25 @@ namespace PLH
                     const std::string& opStr,
                     Mode mode)
         {
-            std::vector<uint8_t> Arr(bytes, bytes + arrLen);
-            Init(address, displacement, displacementOffset, isRelative, isIndirect, Arr, mnemonic, opStr, false, false,
-                 mode);
+            Init(address, displacement, displacementOffset, isRelative, isIndirect, bytes, arrLen, mnemonic, opStr,
+                 false, false, mode);
+        }
+
+        /**Decoded instruction, the mnemonic text comes from the id. opStr is accepted for compatibility only,
+        * operand text is always formatted from the instruction bytes when getFullName() asks for it**/
+        Instruction(uint64_t address,
+                    const Displacement& displacement,
+                    const uint8_t displacementOffset,
+                    const bool isRelative,
+                    const bool isIndirect,
+                    uint8_t bytes[],
+                    const size_t arrLen,
+                    const ZydisMnemonic mnemonic,
+                    [[maybe_unused]] const std::string& opStr,
+                    Mode mode)
+        {
+            Init(address, displacement, displacementOffset, isRelative, isIndirect, bytes, arrLen, mnemonic, false,
+                 false, mode);
         }
 
         uint64_t getAbsoluteDestination() const
@@ -195,7 +223,14 @@ namespace PLH
             return m_isIndirect;
         }
 
-        const std::vector<uint8_t>& getBytes() const
+        /**Copy of the instruction bytes, prefer getRawBytes() on hot paths**/
+        std::vector<uint8_t> getBytes() const
+        {
+            return std::vector<uint8_t>(m_bytes, m_bytes + m_size);
+        }
+
+        /**The instruction bytes, size() of them are valid**/
+        const uint8_t* getRawBytes() const
         {
             return m_bytes;
         }
@@ -203,15 +238,21 @@ namespace PLH
         /**Get short symbol name of instruction**/
         std::string getMnemonic() const
         {
-            return m_mnemonic;
+            if (m_mnemonicId != ZYDIS_MNEMONIC_INVALID)
+                return ZydisMnemonicGetString(m_mnemonicId);
+            return m_label;
         }
 
-        /**Get symbol name and parameters**/
-        std::string getFullName() const
+        /**Mnemonic as an enum, cheap to compare. ZYDIS_MNEMONIC_INVALID if the text given on construction isn't one Zydis knows**/
+        ZydisMnemonic getMnemonicId() const
         {
-            return m_mnemonic + " " + m_opStr;
+            return m_mnemonicId;
         }
 
+        /**Get symbol name and parameters. Operands of decoded instructions are formatted from the current bytes
+        * and address, hand written ones keep the operand text they were made with**/
+        std::string getFullName() const;
+
         /** Displacement size in bytes **/
         void setDisplacementSize(uint8_t size)
         {
@@ -225,7 +266,7 @@ namespace PLH
 
         size_t size() const
         {
-            return m_bytes.size();
+            return m_size;
         }
 
         void setRelativeDisplacement(const int64_t displacement)
@@ -238,7 +279,7 @@ namespace PLH
             m_hasDisplacement = true;
 
             assert(
-                static_cast<size_t>(m_dispOffset) + m_dispSize <= m_bytes.size() && m_dispSize <= sizeof(m_displacement.
+                static_cast<size_t>(m_dispOffset) + m_dispSize <= size() && m_dispSize <= sizeof(m_displacement.
                     Relative));
             std::memcpy(&m_bytes[getDisplacementOffset()], &m_displacement.Relative, m_dispSize);
         }
@@ -253,7 +294,7 @@ namespace PLH
             m_hasDisplacement = true;
 
             const auto dispSz = size() - getDisplacementOffset();
-            if (static_cast<uint32_t>(getDisplacementOffset()) + dispSz > m_bytes.size() || dispSz > sizeof(
+            if (static_cast<uint32_t>(getDisplacementOffset()) + dispSz > size() || dispSz > sizeof(
                 m_displacement.Absolute))
             {
                 PolyHook2DebugBreak();
@@ -261,7 +302,7 @@ namespace PLH
             }
 
             assert(
-                (static_cast<uint32_t>(getDisplacementOffset())) + dispSz <= m_bytes.size() && dispSz <= sizeof(
+                (static_cast<uint32_t>(getDisplacementOffset())) + dispSz <= size() && dispSz <= sizeof(
                     m_displacement.Absolute));
             std::memcpy(&m_bytes[getDisplacementOffset()], &m_displacement.Absolute, dispSz);
         }
@@ -271,6 +312,12 @@ namespace PLH
             return m_uid.val;
         }
 
+        /**Give this instruction a fresh identity, used when handing out copies of cached decodes**/
+        void refreshUID()
+        {
+            m_uid = UID(UID::singleton());
+        }
+
         template <typename T>
         static T calculateRelativeDisplacement(uint64_t from, uint64_t to, uint8_t insSize)
         {
@@ -327,22 +374,37 @@ namespace PLH
 
         void addOperandType(OperandType type)
         {
-            m_operands.emplace_back(type);
+            if (m_operandCount >= MAX_OPERANDS)
+            {
+                PolyHook2DebugBreak();
+                return;
+            }
+            m_operands |= static_cast<uint32_t>(type) << (m_operandCount * OPERAND_BITS);
+            m_operandCount++;
         }
 
-        const std::vector<OperandType>& getOperandTypes() const
+        size_t getOperandCount() const
         {
-            return m_operands;
+            return m_operandCount;
         }
 
-        bool startsWithDisplacement() const
+        OperandType getOperandType(const size_t index) const
         {
-            if (getOperandTypes().empty())
-            {
-                return false;
-            }
+            assert(index < m_operandCount);
+            return static_cast<OperandType>((m_operands >> (index * OPERAND_BITS)) & ((1u << OPERAND_BITS) - 1));
+        }
 
-            return getOperandTypes().front() == OperandType::Displacement;
+        std::vector<OperandType> getOperandTypes() const
+        {
+            std::vector<OperandType> types;
+            for (size_t i = 0; i < m_operandCount; i++)
+                types.push_back(getOperandType(i));
+            return types;
+        }
+
+        bool startsWithDisplacement() const
+        {
+            return m_operandCount != 0 && getOperandType(0) == OperandType::Displacement;
         }
 
         // This is kind of lazy, should probably make be a non-static member for each instance
@@ -351,18 +413,55 @@ namespace PLH
             m_accessor = accessor;
         }
 
+        Mode getMode() const
+        {
+            return m_mode;
+        }
+
     private:
+        static constexpr size_t OPERAND_BITS = 2;
+        static constexpr size_t MAX_OPERANDS = 32 / OPERAND_BITS;
+
         void Init(const uint64_t address,
                   const Displacement& displacement,
                   const uint8_t displacementOffset,
                   const bool isRelative,
                   const bool isIndirect,
-                  const std::vector<uint8_t>& bytes,
+                  const uint8_t* bytes,
+                  const size_t size,
                   const std::string& mnemonic,
                   const std::string& opStr,
                   const bool hasDisp,
                   const bool hasImmediate,
                   Mode mode)
+        {
+            // hand written instructions still get an id, so mnemonic checks never compare strings
+            Init(address, displacement, displacementOffset, isRelative, isIndirect, bytes, size,
+                 mnemonicFromString(mnemonic), hasDisp, hasImmediate, mode);
+            if (m_mnemonicId == ZYDIS_MNEMONIC_INVALID)
+            {
+                const size_t len = std::min(mnemonic.size(), sizeof(m_label) - 1);
+                std::memcpy(m_label, mnemonic.data(), len);
+                m_label[len] = '\0';
+            }
+
+            // their bytes may not say what they mean yet, e.g. a rel jmp holding an absolute destination
+            const size_t opLen = std::min(opStr.size(), sizeof(m_opLabel) - 1);
+            std::memcpy(m_opLabel, opStr.data(), opLen);
+            m_opLabel[opLen] = '\0';
+        }
+
+        void Init(const uint64_t address,
+                  const Displacement& displacement,
+                  const uint8_t displacementOffset,
+                  const bool isRelative,
+                  const bool isIndirect,
+                  const uint8_t* bytes,
+                  const size_t size,
+                  const ZydisMnemonic mnemonic,
+                  const bool hasDisp,
+                  const bool hasImmediate,
+                  Mode mode)
         {
             m_address = address;
             m_displacement = displacement;
@@ -370,15 +469,26 @@ namespace PLH
             m_dispSize = 0;
             m_isRelative = isRelative;
             m_isIndirect = isIndirect;
+            m_isCalling = false;
+            m_isBranching = false;
             m_hasDisplacement = hasDisp;
             m_hasImmediate = hasImmediate;
             m_immediate = 0;
             m_immediateSize = 0;
             m_register = ZYDIS_REGISTER_NONE;
 
-            m_bytes = bytes;
-            m_mnemonic = mnemonic;
-            m_opStr = opStr;
+            if (size > MAX_SIZE)
+                PolyHook2DebugBreak();
+            assert(size <= MAX_SIZE);
+            m_size = static_cast<uint8_t>(std::min(size, MAX_SIZE));
+            std::memcpy(m_bytes, bytes, m_size);
+            std::memset(m_bytes + m_size, 0, MAX_SIZE - m_size);
+
+            m_operands = 0;
+            m_operandCount = 0;
+            m_mnemonicId = mnemonic;
+            m_label[0] = '\0';
+            m_opLabel[0] = '\0';
 
             m_uid = UID(UID::singleton());
             m_mode = mode;
@@ -402,10 +512,13 @@ namespace PLH
         uint8_t m_dispOffset; // Offset into the byte array where displacement is encoded
         uint8_t m_dispSize; // Size of the displacement, in bytes
 
-        std::vector<uint8_t> m_bytes; // All the raw bytes of this instruction
-        std::vector<OperandType> m_operands; // Types of all instruction operands
-        std::string m_mnemonic;
-        std::string m_opStr;
+        uint8_t m_bytes[MAX_SIZE]; // All the raw bytes of this instruction
+        uint8_t m_size; // Count of valid bytes in m_bytes
+        uint8_t m_operandCount;
+        uint32_t m_operands; // Types of all instruction operands, OPERAND_BITS each, first operand lowest
+        ZydisMnemonic m_mnemonicId;
+        char m_label[16]; // only set when the text has no ZydisMnemonic, e.g. "dest holder"
+        char m_opLabel[24]; // operand text of hand written instructions, truncated. Decoded ones format their bytes
 
         Mode m_mode;
 
@@ -416,6 +529,8 @@ namespace PLH
 
     static_assert(std::is_nothrow_move_constructible_v<Instruction>,
                   "PLH::Instruction should be noexcept move constructible");
+    static_assert(std::is_trivially_copyable_v<Instruction>,
+                  "PLH::Instruction should be trivially copyable");
 
     inline bool operator==(const Instruction& lhs, const Instruction& rhs)
     {
@@ -426,7 +541,7 @@ namespace PLH
     {
         std::stringstream byteStream;
         for (std::size_t i = 0; i < obj.size(); i++)
-            byteStream << std::hex << std::setfill('0') << std::setw(2) << static_cast<unsigned>(obj.getBytes()[i]) <<
+            byteStream << std::hex << std::setfill('0') << std::setw(2) << static_cast<unsigned>(obj.getRawBytes()[i]) <<
                 " ";
 
         os << std::hex << obj.getAddress() << " [" << obj.size() << "]: ";
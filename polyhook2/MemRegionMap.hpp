@@ -0,0 +1,58 @@
+#ifndef POLYHOOK_2_MEMREGIONMAP_HPP
+#define POLYHOOK_2_MEMREGIONMAP_HPP
+
+#include "polyhook2/PolyHookOs.hpp"
+#include "polyhook2/Enums.hpp"
+
+namespace PLH
+{
+    struct MemRegion
+    {
+        uint64_t start;
+        uint64_t end; // exclusive
+        ProtFlag prot;
+        bool kernel = false; // vdso, vvar, vsyscall: readable but never to be patched
+    };
+
+    /**
+    Cached, address sorted snapshot of the mappings of the current process. Lookups are a
+    binary search over the snapshot and do no I/O. The snapshot is (re)built lazily after
+    invalidate(), and when a lookup misses on an address the OS reports as mapped, so mappings
+    created by other code are picked up on first use. Mappings removed or re-protected by other
+    code are not noticed by lookups, call invalidate() after doing so. MemAccessor's safe reads
+    catch them anyway and re-read the mappings on a fault.
+    **/
+    class MemRegionMap
+    {
+    public:
+        static MemRegionMap& singleton();
+
+        /**Region containing addr, if any**/
+        std::optional<MemRegion> find(uint64_t addr);
+
+        /**Copy of every region intersecting [start, end), in address order**/
+        std::vector<MemRegion> regions(uint64_t start = 0, uint64_t end = std::numeric_limits<uint64_t>::max());
+
+        /**Record a protection change we made ourselves, splitting regions as needed and merging neighbours
+        left with the same protection**/
+        void setProtection(uint64_t start, uint64_t end, ProtFlag prot);
+
+        /**Drop the snapshot, the next lookup re-reads the mappings**/
+        void invalidate();
+
+    private:
+        MemRegionMap() = default;
+
+        // must hold m_mutex
+        void refresh();
+        std::vector<MemRegion>::const_iterator lookup(uint64_t addr) const;
+
+        // cheap OS query telling whether addr is backed by any mapping
+        static bool isMapped(uint64_t addr);
+
+        std::mutex m_mutex;
+        std::vector<MemRegion> m_regions;
+        bool m_stale = true;
+    };
+}
+#endif
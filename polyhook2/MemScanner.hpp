@@ -0,0 +1,61 @@
+#ifndef POLYHOOK_2_MEMSCANNER_HPP
+#define POLYHOOK_2_MEMSCANNER_HPP
+
+#include "polyhook2/PolyHookOs.hpp"
+#include "polyhook2/MemAccessor.hpp"
+#include "polyhook2/Misc.hpp"
+
+namespace PLH
+{
+    enum class ScanMode
+    {
+        ALL, // every match
+        FIRST, // lowest address only, chunks above a known match are skipped
+        NEAREST // closest to ScanOptions::target only, chunks further than a known match are skipped
+    };
+
+    struct ScanOptions
+    {
+        ScanMode mode = ScanMode::ALL;
+        uint64_t target = 0;
+        size_t chunkSize = 0x100000;
+        uint32_t threads = 0; // 0 = hardware concurrency
+        ProtFlag requiredProt = ProtFlag::R; // only regions with all of these flags are scanned, R is always implied
+    };
+
+    /**
+    Scans every readable mapping in a range for patterns using several threads. Readable regions
+    from the MemRegionMap are merged into contiguous spans and cut into chunks, each chunk is read
+    through the MemAccessor with enough overlap that matches straddling a chunk boundary are found.
+    Results always come back in address order.
+    **/
+    class MemScanner
+    {
+    public:
+        explicit MemScanner(const MemAccessor& accessor);
+
+        std::vector<MultiPattern::Match> scan(const MultiPattern& patterns, uint64_t start, uint64_t end,
+                                              const ScanOptions& options = {}) const;
+
+        std::vector<uint64_t> scan(const Pattern& pattern, uint64_t start, uint64_t end,
+                                   const ScanOptions& options = {}) const;
+
+        /**Match closest to target within the +-2GB window reachable by a rel32 from target. Only executable
+        regions are scanned, so the match can't be pattern storage or a copy on the heap**/
+        std::optional<uint64_t> findNearest(const Pattern& pattern, uint64_t target) const;
+
+    private:
+        struct Chunk
+        {
+            uint64_t start; // matches must begin in [start, end)
+            uint64_t end;
+            uint64_t readEnd; // end plus the overlap, clipped to the span
+            uint64_t distance; // closest distance to ScanOptions::target, NEAREST only
+        };
+
+        std::vector<Chunk> makeChunks(uint64_t start, uint64_t end, size_t overlap, const ScanOptions& options) const;
+
+        const MemAccessor& m_accessor;
+    };
+}
+#endif
@@ -195,6 +195,95 @@ namespace PLH
     uint64_t findPattern_rev(uint64_t rangeStart, size_t len, const char* pattern);
     uint64_t getPatternSize(const char* pattern);
 
+    /**
+     * A findPattern pattern parsed once into bytes and a mask. Scanning anchors on the two rarest
+     * fixed bytes and tests 16 or 32 candidate offsets per step with SSE2/AVX2 where the cpu has them,
+     * only candidates passing both anchors are compared in full. The scalar path returns the same results.
+     **/
+    class Pattern
+    {
+    public:
+        // same syntax as findPattern, "48 8b ?? 90"
+        explicit Pattern(const char* pattern);
+
+        size_t size() const
+        {
+            return m_bytes.size();
+        }
+
+        /**First match fully inside [rangeStart, rangeStart + len), 0 if none**/
+        uint64_t find(uint64_t rangeStart, size_t len) const;
+
+        /**Last match fully inside [rangeStart, rangeStart + len), 0 if none**/
+        uint64_t find_rev(uint64_t rangeStart, size_t len) const;
+
+        bool matches(const uint8_t* addr) const;
+
+    private:
+        friend class MultiPattern;
+
+        std::vector<uint8_t> m_bytes;
+        std::vector<uint8_t> m_mask; // 1 = compare, 0 = wildcard
+
+        // offsets of the rarest fixed bytes, equal if the pattern has only one fixed byte
+        size_t m_anchor1 = 0;
+        size_t m_anchor2 = 0;
+        bool m_hasFixed = false;
+    };
+
+    /**
+     * Several patterns matched in a single pass over the data. Patterns are bucketed by their first
+     * byte, so each position only tests the patterns that can start with the byte found there, plus
+     * the ones starting with a wildcard. The index of a pattern in the list is its priority, lower wins.
+     **/
+    class MultiPattern
+    {
+    public:
+        struct Match
+        {
+            uint64_t address;
+            size_t index; // position of the pattern in the list given to the constructor
+        };
+
+        explicit MultiPattern(std::vector<Pattern> patterns);
+
+        size_t size() const
+        {
+            return m_patterns.size();
+        }
+
+        const Pattern& operator[](const size_t index) const
+        {
+            return m_patterns[index];
+        }
+
+        /**Every match fully inside [rangeStart, rangeStart + len), by address then priority**/
+        std::vector<Match> findAll(uint64_t rangeStart, size_t len) const;
+
+        /**First occurrence of the highest priority pattern that occurs at all**/
+        std::optional<Match> findBest(uint64_t rangeStart, size_t len) const;
+
+        /**Last occurrence of the highest priority pattern that occurs at all**/
+        std::optional<Match> findBest_rev(uint64_t rangeStart, size_t len) const;
+
+    private:
+        // calls f(index) for the patterns that may start at p, in priority order, until f returns false
+        template <typename F>
+        void forCandidates(const uint8_t* p, size_t remaining, F&& f) const;
+
+        std::vector<Pattern> m_patterns;
+
+        // pattern indices grouped by first byte, bucket b is m_buckets[m_bucketStart[b] .. m_bucketStart[b + 1])
+        std::vector<uint32_t> m_buckets;
+        uint32_t m_bucketStart[257] = {};
+
+        // patterns whose first byte is a wildcard, tested at every position
+        std::vector<uint32_t> m_wildcardFirst;
+    };
+
+    // all matches of all patterns in one pass, see MultiPattern::findAll
+    std::vector<MultiPattern::Match> findPatterns(uint64_t rangeStart, size_t len, const std::vector<const char*>& patterns);
+
     bool boundedAllocSupported();
     uint64_t boundAlloc(uint64_t min, uint64_t max, uint64_t size, ULONG pageProtection = PAGE_EXECUTE_READWRITE);
     uint64_t boundAllocLegacy(uint64_t min, uint64_t max, uint64_t size, ULONG pageProtection = PAGE_EXECUTE_READWRITE);
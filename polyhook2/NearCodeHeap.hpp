@@ -0,0 +1,67 @@
+#ifndef POLYHOOK_2_NEARCODEHEAP_HPP
+#define POLYHOOK_2_NEARCODEHEAP_HPP
+
+#include "polyhook2/PolyHookOs.hpp"
+#include "polyhook2/Misc.hpp"
+#include "polyhook2/RangeAllocator.hpp"
+
+namespace PLH
+{
+    /**
+     * Process wide heap of executable memory placed near the code that uses it. Chunks are reserved
+     * with boundAlloc inside the +-2GB window of a target and variable sized blocks are carved out of
+     * them, so trampolines, destination holders and other stubs can reach the hooked code with rel32
+     * jumps and rip relative displacements. Chunks are looked up outward from the target, the closest
+     * one with room wins. Chunks stay reserved for the life of the process and are reused by later hooks.
+     * Small blocks such as destination holders come from a lock-free RangeAllocator instead, so the
+     * common per-hook allocations never take the heap's mutex.
+     **/
+    class NearCodeHeap
+    {
+    public:
+        // reservation unit, the allocation granularity on windows
+        static constexpr uint64_t CHUNK_SIZE = 0x10000;
+
+        // every block starts on this boundary
+        static constexpr uint64_t BLOCK_ALIGN = 16;
+
+        // requests up to this size are fixed size blocks from the RangeAllocator
+        static constexpr uint16_t SMALL_BLOCK_SIZE = 32;
+
+        static NearCodeHeap& singleton();
+
+        /**size bytes of RWX memory reachable with a rel32 from target, 0 if none could be reserved**/
+        uint64_t allocate(uint64_t target, uint64_t size);
+
+        /**size bytes of RWX memory lying entirely inside [min, max), as close to target as possible**/
+        uint64_t allocate(uint64_t target, uint64_t size, uint64_t min, uint64_t max);
+
+        /**Return a block handed out by allocate**/
+        void deallocate(uint64_t address);
+
+    private:
+        struct Chunk
+        {
+            uint64_t end;
+            std::map<uint64_t, uint64_t> free; // start -> length of each free run, never adjacent
+        };
+
+        NearCodeHeap();
+
+        // must hold m_mutex
+        uint64_t takeFrom(Chunk& chunk, uint64_t size, uint64_t min, uint64_t max);
+        uint64_t reserveChunk(uint64_t target, uint64_t size, uint64_t min, uint64_t max);
+
+        RangeAllocator m_small;
+
+        std::mutex m_mutex;
+
+        // start -> chunk
+        std::map<uint64_t, Chunk> m_chunks;
+
+        // start -> length of every block handed out
+        std::map<uint64_t, uint64_t> m_used;
+    };
+}
+
+#endif
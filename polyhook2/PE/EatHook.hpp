@@ -8,7 +8,7 @@
 #include "polyhook2/Misc.hpp"
 #include "polyhook2/PE/PEB.hpp"
 #include "polyhook2/ZydisDisassembler.hpp"
-#include "polyhook2/RangeAllocator.hpp"
+#include "polyhook2/NearCodeHeap.hpp"
 
 #define RVA2VA(type, base, rva) (type)((ULONG_PTR) base + rva)
 
@@ -22,7 +22,7 @@ public:
 	virtual ~EatHook()
 	{
 		if (m_trampoline) {
-			m_allocator.deallocate(m_trampoline);
+			NearCodeHeap::singleton().deallocate(m_trampoline);
 			m_trampoline = 0;
 		}
 	}
@@ -49,8 +49,7 @@ protected:
 	uint64_t m_origFunc;
 	uint64_t* m_userOrigVar;
 
-	// only used if EAT offset points >= 2GB
-	RangeAllocator m_allocator;
+	// only used if EAT offset points >= 2GB, from NearCodeHeap
 	uint64_t m_trampoline;
 
 	uint64_t m_moduleBase;
@@ -61,14 +61,19 @@
 #include <fstream>
 
 #include <vector>
+#include <array>
 #include <map>
+#include <deque>
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
 #include <filesystem>
 
 #include <mutex>
+#include <shared_mutex>
 #include <atomic>
+#include <thread>
+#include <chrono>
 
 #include <memory>
 #include <stdexcept>
@@ -79,6 +84,7 @@
 #include <type_traits>
 #include <tuple>
 #include <utility>
+#include <bit>
 
 #include <cctype>
 #include <cassert>
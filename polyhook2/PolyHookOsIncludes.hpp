@@ -17,7 +17,9 @@
 #elif defined(POLYHOOK2_OS_LINUX)
 
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <cerrno>
 
 #elif defined(POLYHOOK2_OS_APPLE)
 
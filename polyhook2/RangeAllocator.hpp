@@ -7,17 +7,22 @@
 
 namespace PLH
 {
-    // wrapper over fb_allocator in C, with heap backing from VirtualAlloc2 to enforce range
+    /**
+    Fixed block allocator over a pool from boundAlloc, so every block lies inside the range the pool
+    was created for. Allocation and deallocation are lock-free: never used blocks are handed out by
+    bumping an index, returned blocks go on a Treiber stack whose head carries an ABA tag. The stack
+    links live beside the pool, never in the (possibly executable) blocks themselves.
+    **/
     class FBAllocator
     {
     public:
-        FBAllocator(uint64_t min, uint64_t max, uint8_t blockSize, uint8_t blockCount);
+        FBAllocator(uint64_t min, uint64_t max, uint16_t blockSize, uint32_t blockCount);
         ~FBAllocator();
         bool initialize();
 
         char* allocate();
 
-        char* callocate(uint8_t num);
+        char* callocate(uint32_t num);
 
         void deallocate(char* mem);
 
@@ -28,36 +33,93 @@ namespace PLH
         // if a range intersections, by what % of the given range is the overlap
         uint8_t intersectionLoadFactor(uint64_t min, uint64_t max);
 
+        // [poolStart, poolEnd) is the memory blocks are handed out from, valid after initialize
+        uint64_t poolStart() const
+        {
+            return m_dataPool;
+        }
+
+        uint64_t poolEnd() const;
+
+        uint32_t blocksInUse() const
+        {
+            return m_usedBlocks.load(std::memory_order_relaxed);
+        }
+
+        uint32_t maxBlocksInUse() const
+        {
+            return m_maxUsedBlocks.load(std::memory_order_relaxed);
+        }
+
+        bool isFull() const
+        {
+            return blocksInUse() >= m_maxBlocks;
+        }
+
+        bool isEmpty() const
+        {
+            return blocksInUse() == 0;
+        }
+
     private:
+        // free list head: ABA tag in the high half, index + 1 of the top block in the low half, 0 = empty
+        static constexpr uint64_t FREE_EMPTY = 0;
+
+        char* blockAt(uint32_t index) const;
+        void countAllocation();
+
         bool m_alloc2Supported;
-        uint8_t m_usedBlocks;
-        uint8_t m_maxBlocks;
-        uint8_t m_blockSize;
+        uint32_t m_maxBlocks;
+        uint16_t m_blockSize;
         uint64_t m_min;
         uint64_t m_max;
         uint64_t m_dataPool;
 
-        ALLOC_Allocator* m_allocator;
-        ALLOC_HANDLE m_hAllocator;
+        std::atomic<uint64_t> m_freeHead;
+        std::unique_ptr<std::atomic<uint32_t>[]> m_freeNext; // index + 1 of the block below, per block
+        std::atomic<uint32_t> m_poolIndex; // blocks below this were handed out at least once
+
+        std::atomic<uint32_t> m_usedBlocks;
+        std::atomic<uint32_t> m_maxUsedBlocks;
     };
 
+    /**
+    Hands out fixed size blocks that lie inside a requested [min, max) address range. Pools are
+    indexed by the address of their memory, so finding a pool with a free block inside the range
+    and finding the pool owning a block on deallocate are both logarithmic in the number of pools.
+    The pool maps are only written under an exclusive lock, so the common case, a block from an
+    existing pool, runs under a shared lock with the pools themselves lock-free.
+    **/
     class RangeAllocator
     {
     public:
-        RangeAllocator(uint8_t blockSize, uint8_t blockCount);
+        RangeAllocator(uint16_t blockSize, uint32_t blockCount);
         ~RangeAllocator() = default;
 
         char* allocate(uint64_t min, uint64_t max);
+
+        /**A block inside [min, max) from the pool nearest to target, a new pool is placed close to target**/
+        char* allocate(uint64_t min, uint64_t max, uint64_t target);
+
         void deallocate(uint64_t addr);
 
+        /**Whether addr is inside one of the pools, i.e. came from allocate**/
+        bool owns(uint64_t addr) const;
+
     private:
-        std::shared_ptr<FBAllocator> findOrInsertAllocator(uint64_t min, uint64_t max);
+        // the pool nearest to target that fits [min, max) among those believed to have free blocks
+        std::shared_ptr<FBAllocator> findFreeAllocator(uint64_t min, uint64_t max, uint64_t target) const;
+
+        uint32_t m_maxBlocks;
+        uint16_t m_blockSize;
+        mutable std::shared_mutex m_mutex;
+
+        // every pool, keyed by poolStart
+        std::map<uint64_t, std::shared_ptr<FBAllocator>> m_allocators;
 
-        uint8_t m_maxBlocks;
-        uint8_t m_blockSize;
-        std::mutex m_mutex;
-        std::vector<std::shared_ptr<FBAllocator>> m_allocators;
-        std::unordered_map<uint64_t, std::shared_ptr<FBAllocator>> m_allocMap;
+        // pools believed to have a free block, keyed by poolStart. A hint, blocks may be taken or
+        // returned concurrently, it's corrected under the exclusive lock
+        std::map<uint64_t, std::shared_ptr<FBAllocator>> m_freeAllocators;
     };
 }
 
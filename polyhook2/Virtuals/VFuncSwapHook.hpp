@@ -5,6 +5,8 @@
 #include "polyhook2/IHook.hpp"
 #include "polyhook2/MemProtector.hpp"
 #include "polyhook2/Misc.hpp"
+#include "polyhook2/HookEvents.hpp"
+#include "polyhook2/Virtuals/VTableInfo.hpp"
 
 namespace PLH {
 typedef std::map<uint16_t, uint64_t> VFuncMap;
@@ -25,12 +27,19 @@ public:
 	virtual HookType getType() const override {
 		return HookType::VTableSwap;
 	}
+
+	/**Use count virtual functions instead of measuring the vtable, set before hook**/
+	void setVFuncCount(uint16_t count) {
+		m_knownVFuncCount = count;
+	}
 protected:
 	uint16_t countVFuncs();
+	void publishEvent(HookEvent::Kind kind, bool success, const HookEvents::Start& start) const;
 	uint64_t  m_class;
 	uintptr_t* m_vtable;
 
 	uint16_t  m_vFuncCount;
+	uint16_t  m_knownVFuncCount;
 
 	// index -> ptr val 
 	VFuncMap m_redirectMap;
@@ -0,0 +1,42 @@
+#ifndef POLYHOOK_2_VTABLEINFO_HPP
+#define POLYHOOK_2_VTABLEINFO_HPP
+
+#include "polyhook2/PolyHookOs.hpp"
+#include "polyhook2/MemRegionMap.hpp"
+
+namespace PLH
+{
+    /**
+     * Process wide cache of virtual function counts, keyed by vtable address. A vtable is measured
+     * once: the table is bounded by the end of the mapping it lives in, and it ends at the first slot
+     * that does not point into an executable mapping. What follows a table never does, on MSVC that is
+     * the next table's RTTI locator and with the Itanium ABI the next table's offset-to-top and
+     * typeinfo. Itanium tables are also checked to start right after such a header.
+     **/
+    class VTableInfo
+    {
+    public:
+        // tables are never measured past this many slots
+        static constexpr uint16_t MAX_VFUNCS = 500;
+
+        static VTableInfo& singleton();
+
+        /**Number of virtual functions in vtable, 0 if it does not look like the start of one**/
+        uint16_t countVFuncs(const uintptr_t* vtable);
+
+        /**Record a known count, lookups of vtable return it without measuring**/
+        void setVFuncCount(const uintptr_t* vtable, uint16_t count);
+
+        /**Forget every count, e.g. after modules were unloaded**/
+        void clear();
+
+    private:
+        VTableInfo() = default;
+
+        static uint16_t measure(const uintptr_t* vtable);
+
+        std::mutex m_mutex;
+        std::unordered_map<const uintptr_t*, uint16_t> m_counts;
+    };
+}
+#endif
@@ -5,6 +5,8 @@
 #include "polyhook2/IHook.hpp"
 #include "polyhook2/MemProtector.hpp"
 #include "polyhook2/Misc.hpp"
+#include "polyhook2/HookEvents.hpp"
+#include "polyhook2/Virtuals/VTableInfo.hpp"
 
 namespace PLH {
 
@@ -27,8 +29,23 @@ public:
 	virtual HookType getType() const override {
 		return HookType::VTableSwap;
 	}
+
+	/**Use count virtual functions instead of measuring the vtable, set before hook**/
+	void setVFuncCount(uint16_t count) {
+		m_knownVFuncCount = count;
+	}
+
+	/**
+	 * Share one redirected vtable clone between every object whose vtable is the same, set before hook.
+	 * The clone is refcounted and freed when the last sharing hook unhooks. All sharing hooks must use
+	 * the same redirect map. Refused while hooked.
+	 **/
+	void setSharedVTable(bool shared);
 protected:
 	uint16_t countVFuncs();
+	bool hookShared();
+	void releaseShared();
+	void publishEvent(HookEvent::Kind kind, bool success, const HookEvents::Start& start) const;
 
 	std::unique_ptr<uintptr_t[]> m_newVtable;
 	uintptr_t* m_origVtable;
@@ -36,6 +53,9 @@ protected:
 	uint64_t  m_class;
 
 	uint16_t  m_vFuncCount;
+	uint16_t  m_knownVFuncCount;
+
+	bool m_shared;
 
 	// index -> ptr val 
 	VFuncMap m_redirectMap;
@@ -7,6 +7,7 @@
 #include "polyhook2/PolyHookOs.hpp"
 #include "polyhook2/Instruction.hpp"
 #include "polyhook2/MemAccessor.hpp"
+#include "polyhook2/DecodeCache.hpp"
 
 namespace PLH {
 typedef std::unordered_map<uint64_t, insts_t> branch_map_t;
@@ -19,6 +20,26 @@ public:
 
 	std::vector<PLH::Instruction> disassemble(uint64_t firstInstruction, uint64_t start, uint64_t end, const MemAccessor& accessor);
 
+	/**Decode every instruction in [start, end) without stopping at the end of a function,
+	* undecodable bytes are skipped one at a time. Branches within the region land in the branch map.
+	**/
+	PLH::insts_t disassembleRegion(uint64_t start, uint64_t end, const MemAccessor& accessor);
+
+	/**Decode the function at start by following its control flow: conditional and direct jump
+	* targets within [start, start + maxSize) are decoded too, calls are not followed. Instructions
+	* come back sorted by address with the branches between them in the branch map.
+	**/
+	PLH::insts_t disassembleFunction(uint64_t start, const MemAccessor& accessor, uint64_t maxSize = 0x4000);
+
+	/**Serve repeated decodes of unchanged bytes from cache, nullptr disables caching (the default)**/
+	void setDecodeCache(std::shared_ptr<DecodeCache> cache) {
+		m_decodeCache = std::move(cache);
+	}
+
+	const std::shared_ptr<DecodeCache>& getDecodeCache() const {
+		return m_decodeCache;
+	}
+
     // TODO: Move to accessor
 	static void writeEncoding(const PLH::insts_t& instructions, const MemAccessor& accessor) {
 		for (const auto& inst : instructions)
@@ -33,8 +54,8 @@ public:
 	* an instruction should be disasm instructions -> set relative/absolute displacement() ->
 	**/
 	static void writeEncoding(const Instruction& instruction, const MemAccessor& accessor) {
-		assert(instruction.size() <= instruction.getBytes().size());
-		accessor.mem_copy(instruction.getAddress(), (uint64_t)&instruction.getBytes()[0], instruction.size());
+		accessor.mem_copy(instruction.getAddress(), (uint64_t)instruction.getRawBytes(), instruction.size());
+		DecodeCache::notifyWrite(instruction.getAddress(), instruction.size());
 	}
 
 	static bool isConditionalJump(const PLH::Instruction& instruction) {
@@ -42,7 +63,7 @@ public:
 		if (instruction.size() < 1)
 			return false;
 
-		std::vector<uint8_t> bytes = instruction.getBytes();
+		const uint8_t* bytes = instruction.getRawBytes();
 		if (bytes[0] == 0x0F && instruction.size() > 1) {
 			if (bytes[1] >= 0x80 && bytes[1] <= 0x8F)
 				return true;
@@ -72,23 +93,28 @@ public:
 		* 0xFDFDFDFD : Used by Microsoft's C++ debugging heap to mark "no man's land" guard bytes before and after allocated heap memory
 		* 0xFEEEFEEE : Used by Microsoft's HeapFree() to mark freed heap memory
 		*/
-		std::string mnemonic = instruction.getMnemonic();
-		auto bytes = instruction.getBytes();
+		const ZydisMnemonic mnemonic = instruction.getMnemonicId();
+		const uint8_t* bytes = instruction.getRawBytes();
 		return (instruction.size() == 1 && bytes[0] == 0xCC) ||
 			(instruction.size() >= 2 && bytes[0] == 0xf3 && bytes[1] == 0xc3) ||
-            (mnemonic == "jmp" && !firstFunc) || // Jump to tranlslation
-			mnemonic == "ret" || mnemonic.find("iret") == 0;
+            (mnemonic == ZYDIS_MNEMONIC_JMP && !firstFunc) || // Jump to tranlslation
+			mnemonic == ZYDIS_MNEMONIC_RET || mnemonic == ZYDIS_MNEMONIC_IRET ||
+			mnemonic == ZYDIS_MNEMONIC_IRETD || mnemonic == ZYDIS_MNEMONIC_IRETQ;
 	}
 
 	static bool isPadBytes(const PLH::Instruction& instruction) {
 		// supports multi-byte nops
-		return instruction.getMnemonic() == "nop";
+		return instruction.getMnemonicId() == ZYDIS_MNEMONIC_NOP;
 	}
 
+	/**Operand text of an instruction, formatted from its current bytes and address**/
+	static std::string formatOperands(const PLH::Instruction& instruction);
+
 	const branch_map_t& getBranchMap() const {
 		return m_branchMap;
 	}
 
+	// scans all of insVec per call, the disassemble functions use the indexed overload below
 	void addToBranchMap(PLH::insts_t& insVec, const PLH::Instruction& inst)
 	{
 		if (inst.isBranching()) {
@@ -114,6 +140,16 @@ public:
 		return m_mode;
 	}
 protected:
+	// address lookups for linking branches while a vector of instructions is built up
+	struct BranchIndex {
+		std::unordered_map<uint64_t, size_t> starts; // instruction address -> index
+		std::unordered_map<uint64_t, std::vector<size_t>> pending; // not yet decoded destination -> indices branching there
+	};
+
+	// same result as addToBranchMap(insVec, insVec.back()) in constant time, insVec.back() must be the newest instruction
+	void addToBranchMap(PLH::insts_t& insVec, BranchIndex& index);
+
+	std::optional<PLH::Instruction> decodeOne(uint8_t* buf, size_t avail, uint64_t address);
 
 	bool getOpStr(ZydisDecodedInstruction* pInstruction, const ZydisDecodedOperand* decoded_operands, uint64_t addr, std::string* pOpStrOut);
 
@@ -137,6 +173,8 @@ protected:
 
 	Mode          m_mode;
 
+	std::shared_ptr<DecodeCache> m_decodeCache;
+
 	/* key = address of instruction pointed at (dest of jump). Value = set of unique instruction branching to dest
 	   Must only hold entries from the last segment disassembled. I.E clear every new call to disassemble
 	*/
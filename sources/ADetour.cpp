@@ -20,6 +20,213 @@ namespace PLH
         m_isFollowCallOnFnAddress = value;
     }
 
+    void Detour::setDecodeCache(std::shared_ptr<DecodeCache> cache)
+    {
+        m_disasm.setDecodeCache(std::move(cache));
+    }
+
+    void Detour::setStatsMode(const StatsMode mode)
+    {
+        if (m_statsThunk && mode != m_statsMode)
+        {
+            PLH_LOG("Stats mode can't change once the hook was prepared", ErrorLevel::WARN);
+            return;
+        }
+        m_statsMode = mode;
+    }
+
+    const HookStats* Detour::getStats() const
+    {
+        return m_stats.get();
+    }
+
+    uint64_t Detour::getHookDestination() const
+    {
+        return m_statsThunk ? m_statsThunk : m_fnCallback;
+    }
+
+    bool Detour::prepareStats()
+    {
+        using namespace asmjit;
+
+        if (m_statsMode == StatsMode::Off || m_statsThunk)
+        {
+            return true;
+        }
+
+        const Environment& env = g_asmjit_rt.environment();
+        const bool x64 = getArchType() == Mode::x64;
+        if (x64 != (env.arch() == Arch::kX64))
+        {
+            PLH_LOG("Hook stats are only supported for detours of the host architecture", ErrorLevel::SEV);
+            return false;
+        }
+
+        auto stats = std::make_unique<HookStats>();
+        const uint64_t calls = (uint64_t)&stats->m_calls;
+        const bool latency = m_statsMode == StatsMode::Latency;
+
+        CodeHolder code;
+        code.init(env);
+        x86::Assembler a(&code);
+        const Label callbackSlot = a.newLabel();
+        const Label exitThunk = a.newLabel();
+
+        if (x64)
+        {
+            a.push(x86::rax);
+            a.mov(x86::rax, calls);
+            a.lock().inc(x86::qword_ptr(x86::rax));
+            a.pop(x86::rax);
+        }
+        else
+        {
+            // two locked halves, a reader may briefly see the carry missing
+            a.lock().add(x86::dword_ptr(calls), 1);
+            a.lock().adc(x86::dword_ptr(calls + 4), 0);
+        }
+
+        if (latency && x64)
+        {
+            /* Spill everything that may carry arguments, call HookStats::enter with the return address
+               slot and restore. Upper ymm halves are left alone, enter doesn't use AVX */
+            const bool win = env.isPlatformWindows();
+            const std::vector<x86::Gp> gps = win
+                                                 ? std::vector<x86::Gp>{x86::rcx, x86::rdx, x86::r8, x86::r9}
+                                                 : std::vector<x86::Gp>{
+                                                     x86::rdi, x86::rsi, x86::rdx, x86::rcx, x86::r8, x86::r9,
+                                                     x86::rax, x86::r10
+                                                 };
+            const uint32_t xmmCount = win ? 6 : 8;
+            const int32_t shadow = win ? 32 : 0;
+
+            // the return address leaves rsp 8 off, keep it 16 byte aligned at the call
+            const int32_t frame = shadow + 16 * xmmCount + (gps.size() % 2 == 0 ? 8 : 0);
+            const int32_t returnSlot = frame + (int32_t)(sizeof(uint64_t) * gps.size());
+
+            for (const auto& gp : gps)
+            {
+                a.push(gp);
+            }
+            a.sub(x86::rsp, frame);
+            for (uint32_t i = 0; i < xmmCount; i++)
+            {
+                a.movdqu(x86::ptr(x86::rsp, shadow + 16 * i), x86::xmm(i));
+            }
+
+            a.mov(win ? x86::rcx : x86::rdi, (uint64_t)stats.get());
+            a.lea(win ? x86::rdx : x86::rsi, x86::ptr(x86::rsp, returnSlot));
+            a.mov(x86::rax, (uint64_t)&HookStats::enter);
+            a.call(x86::rax);
+
+            for (uint32_t i = 0; i < xmmCount; i++)
+            {
+                a.movdqu(x86::xmm(i), x86::ptr(x86::rsp, shadow + 16 * i));
+            }
+            a.add(x86::rsp, frame);
+            for (auto gp = gps.rbegin(); gp != gps.rend(); ++gp)
+            {
+                a.pop(*gp);
+            }
+            a.jmp(x86::qword_ptr(callbackSlot));
+
+            // returning calls land here, keep the return registers while HookStats::leave runs
+            const int32_t exitFrame = shadow + 2 * 16 + 8;
+            a.bind(exitThunk);
+            a.sub(x86::rsp, 8);
+            a.push(x86::rax);
+            a.push(x86::rdx);
+            a.sub(x86::rsp, exitFrame);
+            a.movdqu(x86::ptr(x86::rsp, shadow), x86::xmm0);
+            a.movdqu(x86::ptr(x86::rsp, shadow + 16), x86::xmm1);
+            a.mov(x86::rax, (uint64_t)&HookStats::leave);
+            a.call(x86::rax);
+            a.mov(x86::ptr(x86::rsp, exitFrame + 16), x86::rax);
+            a.movdqu(x86::xmm0, x86::ptr(x86::rsp, shadow));
+            a.movdqu(x86::xmm1, x86::ptr(x86::rsp, shadow + 16));
+            a.add(x86::rsp, exitFrame);
+            a.pop(x86::rdx);
+            a.pop(x86::rax);
+            a.ret();
+        }
+        else if (latency)
+        {
+            // pushad keeps ebp, which holds the unaligned esp so the helper is called 16 byte aligned
+            a.pushad();
+            a.lea(x86::eax, x86::ptr(x86::esp, 32));
+            a.mov(x86::ebp, x86::esp);
+            a.and_(x86::esp, -16);
+            a.sub(x86::esp, 8);
+            a.push(x86::eax);
+            a.push(Imm((uint32_t)(uintptr_t)stats.get()));
+            a.mov(x86::eax, (uint32_t)(uintptr_t)&HookStats::enter);
+            a.call(x86::eax);
+            a.mov(x86::esp, x86::ebp);
+            a.popad();
+            a.jmp(x86::dword_ptr(callbackSlot));
+
+            a.bind(exitThunk);
+            a.sub(x86::esp, 4);
+            a.push(x86::eax);
+            a.push(x86::edx);
+            a.push(x86::ebp);
+            a.mov(x86::ebp, x86::esp);
+            a.and_(x86::esp, -16);
+            a.mov(x86::ecx, (uint32_t)(uintptr_t)&HookStats::leave);
+            a.call(x86::ecx);
+            a.mov(x86::esp, x86::ebp);
+            a.pop(x86::ebp);
+            a.mov(x86::dword_ptr(x86::esp, 8), x86::eax);
+            a.pop(x86::edx);
+            a.pop(x86::eax);
+            a.ret();
+        }
+        else
+        {
+            a.jmp(x64 ? x86::qword_ptr(callbackSlot) : x86::dword_ptr(callbackSlot));
+        }
+
+        a.align(AlignMode::kData, sizeof(uint64_t));
+        a.bind(callbackSlot);
+        a.embedUInt64(m_fnCallback);
+
+        uint64_t thunk = 0;
+        if (const auto error = g_asmjit_rt.add(&thunk, &code))
+        {
+            PLH_LOG(std::string("Failed to generate stats thunk: ") + DebugUtils::errorAsString(error),
+                    ErrorLevel::SEV);
+            return false;
+        }
+
+        if (latency)
+        {
+            stats->m_exitThunk = (uintptr_t)(thunk + code.labelOffsetFromBase(exitThunk));
+        }
+
+        m_stats = std::move(stats);
+        m_statsThunk = thunk;
+        PLH_LOG("Stats thunk: " + int_to_hex(m_statsThunk), ErrorLevel::INFO);
+        return true;
+    }
+
+    void Detour::releaseStats()
+    {
+        // a call still in flight may return into the exit thunk and record into the stats, keep both alive
+        if (m_stats && m_stats->m_exitThunk)
+        {
+            (void)m_stats.release();
+            m_statsThunk = 0;
+            return;
+        }
+
+        if (m_statsThunk)
+        {
+            g_asmjit_rt.release((void*)m_statsThunk);
+            m_statsThunk = 0;
+        }
+        m_stats.reset();
+    }
+
     std::optional<insts_t> Detour::calcNearestSz(
         const insts_t& functionInsts,
         const uint64_t prolOvrwStartOffset,
@@ -207,17 +414,50 @@ namespace PLH
         }
     }
 
-    bool Detour::unHook()
+    bool Detour::hook()
     {
-        if (!m_hooked)
+        const auto start = HookEvents::singleton().startTiming();
+        bool success = false;
+        auto publish = finally([&]()
         {
-            PLH_LOG("Detour unhook failed: no hook present", ErrorLevel::SEV);
+            publishEvent(HookEvent::Kind::Install, success, start, m_trampoline);
+        });
+
+        if (!prepareHook())
+        {
+            // give back whatever was claimed before the failure, the cave, holder, trampoline
+            cancelHook();
             return false;
         }
 
-        MemoryProtector prot(m_fnAddress, calcInstsSz(m_originalInsts), R | W | X, *this);
-        ZydisDisassembler::writeEncoding(m_originalInsts, *this);
+        MemoryProtector prot(m_fnAddress, m_hookSize, RWX, *this);
+        success = commitHook();
+        return success;
+    }
+
+    bool Detour::commitHook()
+    {
+        assert(!m_hooked);
+        assert(!m_hookInsts.empty());
+
+        PLH_LOG("Hook instructions:\n" + instsToStr(m_hookInsts) + "\n", ErrorLevel::INFO);
+        ZydisDisassembler::writeEncoding(m_hookInsts, *this);
+
+        PLH_LOG("Hook size: " + std::to_string(m_hookSize) + "\n", ErrorLevel::INFO);
+        PLH_LOG("Prologue offset: " + std::to_string(m_nopProlOffset) + "\n", ErrorLevel::INFO);
+
+        // Nop the space between jmp and end of prologue
+        assert(m_hookSize >= m_nopProlOffset);
+        m_nopSize = static_cast<uint16_t>(m_hookSize - m_nopProlOffset);
+        const auto nops = make_nops(m_fnAddress + m_nopProlOffset, m_nopSize);
+        ZydisDisassembler::writeEncoding(nops, *this);
 
+        m_hooked = true;
+        return true;
+    }
+
+    void Detour::cancelHook()
+    {
         if (m_trampoline != NULL)
         {
             g_asmjit_rt.allocator()->release((void*)m_trampoline);
@@ -228,13 +468,66 @@ namespace PLH
         {
             *m_userTrampVar = NULL;
         }
+    }
+
+    uint64_t Detour::getPatchAddress() const
+    {
+        return m_fnAddress;
+    }
+
+    uint32_t Detour::getPatchSize() const
+    {
+        return m_hookSize;
+    }
+
+    bool Detour::unHook()
+    {
+        const auto start = HookEvents::singleton().startTiming();
+        if (!m_hooked)
+        {
+            PLH_LOG("Detour unhook failed: no hook present", ErrorLevel::SEV);
+            publishEvent(HookEvent::Kind::Uninstall, false, start, m_trampoline);
+            return false;
+        }
+
+        MemoryProtector prot(m_fnAddress, calcInstsSz(m_originalInsts), R | W | X, *this);
+        ZydisDisassembler::writeEncoding(m_originalInsts, *this);
+
+        // cancelHook frees the trampoline, report the one that was in use
+        const uint64_t trampoline = m_trampoline;
+        cancelHook();
 
         m_hooked = false;
+        publishEvent(HookEvent::Kind::Uninstall, true, start, trampoline);
         return true;
     }
 
+    void Detour::publishEvent(const HookEvent::Kind kind, const bool success,
+                              const HookEvents::Start& start, const uint64_t trampoline) const
+    {
+        if (!start)
+            return;
+
+        HookEvent event{};
+        event.kind = kind;
+        event.success = success;
+        event.type = getType();
+        event.fnAddress = m_fnAddress;
+        event.scheme = getChosenScheme();
+        event.prologueSize = m_hookSize;
+        event.trampoline = trampoline;
+        HookEvents::singleton().publish(event, start);
+    }
+
     bool Detour::reHook()
     {
+        const auto start = HookEvents::singleton().startTiming();
+        bool success = false;
+        auto publish = finally([&]()
+        {
+            publishEvent(HookEvent::Kind::Rehook, success, start, m_trampoline);
+        });
+
         MemoryProtector prot(m_fnAddress, m_hookSize, RWX, *this);
         ZydisDisassembler::writeEncoding(m_hookInsts, *this);
 
@@ -248,6 +541,7 @@ namespace PLH
         const auto nops = make_nops(m_fnAddress + m_nopProlOffset, m_nopSize);
         ZydisDisassembler::writeEncoding(nops, *this);
 
+        success = true;
         return true;
     }
 
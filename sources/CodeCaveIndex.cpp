@@ -0,0 +1,269 @@
+#include "polyhook2/Detour/CodeCaveIndex.hpp"
+#include "polyhook2/ErrorLog.hpp"
+#include "polyhook2/Misc.hpp"
+
+namespace PLH
+{
+    CodeCaveIndex& CodeCaveIndex::singleton()
+    {
+        static CodeCaveIndex index;
+        return index;
+    }
+
+    std::optional<uint64_t> CodeCaveIndex::acquire(const uint64_t target, const uint32_t size, const uint64_t min,
+                                                   const uint64_t max, const MemAccessor& accessor)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // pay the scan cost once per executable mapping, not once per hook
+        for (const auto& region : MemRegionMap::singleton().regions(min, max))
+        {
+            if (!(region.prot & ProtFlag::X) || !(region.prot & ProtFlag::R) || region.kernel)
+                continue;
+
+            // scan only the gaps between ranges already scanned
+            uint64_t pos = region.start;
+            auto it = m_scanned.upper_bound(pos);
+            if (it != m_scanned.begin() && std::prev(it)->second > pos)
+                pos = std::prev(it)->second;
+
+            while (pos < region.end)
+            {
+                const uint64_t gapEnd = it == m_scanned.end() ? region.end : std::min(it->first, region.end);
+                if (gapEnd > pos)
+                    scanRange(pos, gapEnd, accessor);
+
+                if (it == m_scanned.end())
+                    break;
+                pos = std::max(pos, it->second);
+                ++it;
+            }
+            markScanned(region.start, region.end);
+        }
+
+        const auto fits = [&](const std::map<uint64_t, uint64_t>::iterator it)
+        {
+            return it->second >= size && it->first >= min && it->first + size <= max;
+        };
+
+        // walk outwards from target, always stepping to whichever side is closer
+        auto hi = m_caves.lower_bound(target);
+        auto lo = hi;
+        auto best = m_caves.end();
+        while (best == m_caves.end())
+        {
+            const bool hiValid = hi != m_caves.end() && hi->first < max;
+            const bool loValid = lo != m_caves.begin() && std::prev(lo)->first >= min;
+            if (!hiValid && !loValid)
+                break;
+
+            const bool takeHi = hiValid && (!loValid || hi->first - target <= target - std::prev(lo)->first);
+            if (takeHi)
+            {
+                if (fits(hi))
+                    best = hi;
+                ++hi;
+            }
+            else
+            {
+                --lo;
+                if (fits(lo))
+                    best = lo;
+            }
+        }
+
+        if (best == m_caves.end())
+            return {};
+
+        const uint64_t start = best->first;
+        const uint64_t length = best->second;
+        m_caves.erase(best);
+        m_used.emplace(start, size);
+
+        // keep the tail around if it is still big enough to be useful
+        if (length - size >= MIN_CAVE_SIZE)
+            m_caves.emplace(start + size, length - size);
+
+        PLH_LOG("Code cave index handed out " + int_to_hex(start), ErrorLevel::INFO);
+        return start;
+    }
+
+    bool CodeCaveIndex::claim(const uint64_t address, const uint32_t size)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const uint64_t end = address + size;
+
+        auto used = m_used.lower_bound(end);
+        if (used != m_used.begin() && std::prev(used)->first + std::prev(used)->second > address)
+            return false;
+
+        // carve the claimed bytes out of any free cave overlapping them
+        auto it = m_caves.lower_bound(address);
+        if (it != m_caves.begin() && std::prev(it)->first + std::prev(it)->second > address)
+            --it;
+
+        while (it != m_caves.end() && it->first < end)
+        {
+            const uint64_t caveStart = it->first;
+            const uint64_t caveEnd = caveStart + it->second;
+            it = m_caves.erase(it);
+
+            if (caveStart < address && address - caveStart >= MIN_CAVE_SIZE)
+                m_caves.emplace(caveStart, address - caveStart);
+            if (caveEnd > end && caveEnd - end >= MIN_CAVE_SIZE)
+                it = m_caves.emplace(end, caveEnd - end).first;
+        }
+
+        m_used.emplace(address, size);
+        return true;
+    }
+
+    void CodeCaveIndex::release(const uint64_t address, const uint32_t size)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_used.erase(address);
+        insertCave(address, size);
+    }
+
+    void CodeCaveIndex::clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_caves.clear();
+        m_used.clear();
+        m_scanned.clear();
+    }
+
+    void CodeCaveIndex::markScanned(uint64_t start, uint64_t end)
+    {
+        // absorb every range overlapping or touching [start, end)
+        auto it = m_scanned.upper_bound(start);
+        if (it != m_scanned.begin() && std::prev(it)->second >= start)
+            --it;
+
+        while (it != m_scanned.end() && it->first <= end)
+        {
+            start = std::min(start, it->first);
+            end = std::max(end, it->second);
+            it = m_scanned.erase(it);
+        }
+        m_scanned.emplace(start, end);
+    }
+
+    void CodeCaveIndex::insertCave(uint64_t start, uint64_t length)
+    {
+        // merge with a directly adjacent neighbour on either side
+        auto next = m_caves.lower_bound(start);
+        if (next != m_caves.end() && next->first == start + length)
+        {
+            length += next->second;
+            next = m_caves.erase(next);
+        }
+
+        if (next != m_caves.begin())
+        {
+            const auto prev = std::prev(next);
+            if (prev->first + prev->second == start)
+            {
+                prev->second += length;
+                return;
+            }
+        }
+
+        m_caves.emplace(start, length);
+    }
+
+    void CodeCaveIndex::scanRange(const uint64_t start, const uint64_t end, const MemAccessor& accessor)
+    {
+        enum class State
+        {
+            Code, // looking for a ret
+            RetImm, // skipping the imm16 of a retn
+            PadStart, // byte after a ret, decides which padding byte the run uses
+            Pad // inside a run of padding
+        };
+
+        constexpr uint64_t chunkSize = 0x10000;
+        std::vector<uint8_t> buf(static_cast<size_t>(chunkSize));
+
+        State state = State::Code;
+        uint8_t immLeft = 0;
+        uint8_t padByte = 0;
+        uint64_t padStart = 0;
+
+        const auto onCode = [&](const uint8_t b)
+        {
+            if (b == 0xC3)
+            {
+                state = State::PadStart;
+            }
+            else if (b == 0xC2)
+            {
+                state = State::RetImm;
+                immLeft = 2;
+            }
+            else
+            {
+                state = State::Code;
+            }
+        };
+
+        const auto closeRun = [&](const uint64_t end)
+        {
+            if (state == State::Pad && end - padStart >= MIN_CAVE_SIZE)
+                insertCave(padStart, end - padStart);
+        };
+
+        for (uint64_t chunk = start; chunk < end; chunk += chunkSize)
+        {
+            size_t read = 0;
+            const uint64_t len = std::min(chunkSize, end - chunk);
+            if (!accessor.safe_mem_read(chunk, (uint64_t)buf.data(), len, read) || read == 0)
+            {
+                // never join a run across memory we couldn't read
+                state = State::Code;
+                continue;
+            }
+
+            for (size_t i = 0; i < read; i++)
+            {
+                const uint8_t b = buf[i];
+                const uint64_t addr = chunk + i;
+                switch (state)
+                {
+                case State::Pad:
+                    if (b == padByte)
+                        break;
+
+                    closeRun(addr);
+                    onCode(b);
+                    break;
+                case State::RetImm:
+                    if (--immLeft == 0)
+                        state = State::PadStart;
+                    break;
+                case State::PadStart:
+                    if (b == 0xCC || b == 0x90)
+                    {
+                        state = State::Pad;
+                        padByte = b;
+                        padStart = addr;
+                        break;
+                    }
+                    onCode(b);
+                    break;
+                case State::Code:
+                    onCode(b);
+                    break;
+                }
+            }
+
+            if (read < len)
+            {
+                closeRun(chunk + read);
+                state = State::Code;
+            }
+        }
+
+        closeRun(end);
+    }
+}
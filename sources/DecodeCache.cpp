@@ -0,0 +1,105 @@
+#include "polyhook2/DecodeCache.hpp"
+
+namespace
+{
+    // every live cache, so writes through writeEncoding can reach them without knowing who owns them
+    std::mutex g_registryMutex;
+    std::vector<PLH::DecodeCache*> g_registry;
+    std::atomic<size_t> g_liveCaches = 0;
+}
+
+PLH::DecodeCache::DecodeCache()
+{
+    std::lock_guard<std::mutex> lock(g_registryMutex);
+    g_registry.push_back(this);
+    g_liveCaches++;
+}
+
+PLH::DecodeCache::~DecodeCache()
+{
+    std::lock_guard<std::mutex> lock(g_registryMutex);
+    std::erase(g_registry, this);
+    g_liveCaches--;
+}
+
+size_t PLH::DecodeCache::KeyHash::operator()(const Key& key) const
+{
+    size_t h = std::hash<uint64_t>()(key.firstInstruction);
+    h ^= std::hash<uint64_t>()(key.start) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= std::hash<uint64_t>()(key.end) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= static_cast<size_t>(key.mode) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    return h;
+}
+
+uint64_t PLH::DecodeCache::hashBytes(const uint8_t* bytes, const size_t size)
+{
+    // FNV-1a, the inputs are at most a few hundred bytes
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+std::optional<PLH::insts_t> PLH::DecodeCache::lookup(const uint64_t firstInstruction, const uint64_t start,
+                                                      const uint64_t end, const Mode mode, const uint8_t* bytes,
+                                                      const size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto it = m_entries.find({firstInstruction, start, end, mode});
+    if (it == m_entries.end())
+        return {};
+
+    // written by someone not going through writeEncoding
+    if (it->second.size != size || it->second.hash != hashBytes(bytes, size))
+    {
+        m_entries.erase(it);
+        return {};
+    }
+
+    // copies must not compare equal to the instructions handed out earlier
+    insts_t insts = it->second.insts;
+    for (auto& inst : insts)
+    {
+        inst.refreshUID();
+    }
+    return insts;
+}
+
+void PLH::DecodeCache::store(const uint64_t firstInstruction, const uint64_t start, const uint64_t end,
+                             const Mode mode, const uint8_t* bytes, const size_t size, const insts_t& insts)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries[{firstInstruction, start, end, mode}] = {hashBytes(bytes, size), size, insts};
+}
+
+void PLH::DecodeCache::invalidate(const uint64_t address, const uint64_t size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::erase_if(m_entries, [&](const auto& entry)
+    {
+        const uint64_t decodedStart = entry.first.firstInstruction;
+        const uint64_t decodedEnd = decodedStart + entry.second.size;
+        return decodedStart < address + size && address < decodedEnd;
+    });
+}
+
+void PLH::DecodeCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+}
+
+void PLH::DecodeCache::notifyWrite(const uint64_t address, const uint64_t size)
+{
+    if (g_liveCaches.load(std::memory_order_relaxed) == 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(g_registryMutex);
+    for (DecodeCache* cache : g_registry)
+    {
+        cache->invalidate(address, size);
+    }
+}
@@ -0,0 +1,203 @@
+#include "polyhook2/Detour/DetourBatch.hpp"
+#include "polyhook2/ErrorLog.hpp"
+#include "polyhook2/Misc.hpp"
+#include "polyhook2/HookEvents.hpp"
+#include "polyhook2/MemRegionMap.hpp"
+
+namespace PLH
+{
+    void DetourBatch::add(Detour& detour)
+    {
+        m_entries.push_back({&detour, Status::Pending});
+    }
+
+    const std::vector<DetourBatch::Entry>& DetourBatch::getEntries() const
+    {
+        return m_entries;
+    }
+
+    void DetourBatch::clear()
+    {
+        m_entries.clear();
+    }
+
+    void DetourBatch::rollback(const std::vector<Entry*>& prepared, const Status status)
+    {
+        for (Entry* entry : prepared)
+        {
+            entry->detour->cancelHook();
+            entry->status = status;
+        }
+    }
+
+    void DetourBatch::uncommit(const std::vector<Entry*>& committed)
+    {
+        for (Entry* entry : committed)
+        {
+            Detour* detour = entry->detour;
+            ZydisDisassembler::writeEncoding(detour->m_originalInsts, *detour);
+            detour->m_hooked = false;
+        }
+    }
+
+    size_t DetourBatch::commit()
+    {
+        // one Install event per detour attempted, timed from the start of the batch
+        const auto start = HookEvents::singleton().startTiming();
+        std::vector<const Entry*> attempted;
+        auto publish = finally([&]()
+        {
+            for (const Entry* entry : attempted)
+            {
+                entry->detour->publishEvent(HookEvent::Kind::Install, entry->status == Status::Hooked, start,
+                                            entry->detour->m_trampoline);
+            }
+        });
+
+        // plan every prologue before touching any page
+        std::vector<Entry*> prepared;
+        for (auto& entry : m_entries)
+        {
+            if (entry.status != Status::Pending)
+                continue;
+
+            if (start)
+            {
+                attempted.push_back(&entry);
+            }
+
+            if (entry.detour->isHooked() || !entry.detour->prepareHook())
+            {
+                PLH_LOG("Batch detour failed to prepare: " + int_to_hex(entry.detour->getPatchAddress()),
+                        ErrorLevel::SEV);
+                if (!entry.detour->isHooked())
+                {
+                    // give back whatever was claimed before the failure, the cave, holder, trampoline
+                    entry.detour->cancelHook();
+                }
+                entry.status = Status::PrepareFailed;
+                continue;
+            }
+            prepared.push_back(&entry);
+        }
+
+        if (prepared.empty())
+            return 0;
+
+        std::sort(prepared.begin(), prepared.end(), [](const Entry* a, const Entry* b)
+        {
+            return a->detour->getPatchAddress() < b->detour->getPatchAddress();
+        });
+
+        // two prologues sharing bytes can't both be patched, keep the first one
+        uint64_t lastEnd = 0;
+        std::erase_if(prepared, [&](Entry* entry)
+        {
+            const uint64_t start = entry->detour->getPatchAddress();
+            if (start < lastEnd)
+            {
+                PLH_LOG("Batch detour overlaps a previous prologue: " + int_to_hex(start), ErrorLevel::SEV);
+                entry->detour->cancelHook();
+                entry->status = Status::Overlapping;
+                return true;
+            }
+            lastEnd = start + entry->detour->getPatchSize();
+            return false;
+        });
+
+        // coalesce the touched pages into contiguous spans
+        const uint64_t pageSize = getPageSize();
+        std::vector<std::pair<uint64_t, uint64_t>> spans;
+        for (const Entry* entry : prepared)
+        {
+            const uint64_t start = entry->detour->getPatchAddress();
+            const uint64_t pageStart = MEMORY_ROUND(start, pageSize);
+            const uint64_t pageEnd = MEMORY_ROUND_UP(start + entry->detour->getPatchSize(), pageSize);
+
+            if (!spans.empty() && pageStart <= spans.back().second)
+            {
+                spans.back().second = std::max(spans.back().second, pageEnd);
+                continue;
+            }
+            spans.emplace_back(pageStart, pageEnd);
+        }
+
+        // one protect/restore pair per run. A span running into another mapping, .text into .rodata or
+        // into the next module, is cut at each region boundary so every run gets its own protection back
+        std::vector<PageRun> runs;
+        for (const auto& [spanStart, spanEnd] : spans)
+        {
+            uint64_t cursor = spanStart;
+            for (const MemRegion& region : MemRegionMap::singleton().regions(spanStart, spanEnd))
+            {
+                // pages the map doesn't know are left to mem_protect, which fails on them if they're unmapped
+                if (region.start > cursor)
+                {
+                    runs.push_back({cursor, region.start - cursor, ProtFlag::UNSET});
+                    cursor = region.start;
+                }
+
+                const uint64_t end = std::min(region.end, spanEnd);
+                runs.push_back({cursor, end - cursor, ProtFlag::UNSET});
+                cursor = end;
+            }
+
+            if (cursor < spanEnd)
+            {
+                runs.push_back({cursor, spanEnd - cursor, ProtFlag::UNSET});
+            }
+        }
+
+        for (size_t i = 0; i < runs.size(); i++)
+        {
+            bool status = false;
+            runs[i].origProt = mem_protect(runs[i].start, runs[i].size, RWX, status);
+            if (status)
+                continue;
+
+            PLH_LOG("Batch detour failed to unprotect page run: " + int_to_hex(runs[i].start), ErrorLevel::SEV);
+            for (size_t j = 0; j < i; j++)
+            {
+                mem_protect(runs[j].start, runs[j].size, runs[j].origProt, status);
+            }
+            rollback(prepared, Status::ProtectFailed);
+            return 0;
+        }
+
+        const auto restoreRuns = [&]()
+        {
+            for (const auto& run : runs)
+            {
+                bool status = false;
+                mem_protect(run.start, run.size, run.origProt, status);
+            }
+        };
+
+        std::vector<Entry*> committed;
+        for (Entry* entry : prepared)
+        {
+            if (entry->detour->commitHook())
+            {
+                committed.push_back(entry);
+                continue;
+            }
+
+            PLH_LOG("Batch detour failed to patch prologue: " + int_to_hex(entry->detour->getPatchAddress()),
+                    ErrorLevel::SEV);
+            uncommit(committed);
+            restoreRuns();
+            rollback(prepared, Status::CommitFailed);
+            return 0;
+        }
+
+        for (Entry* entry : committed)
+        {
+            entry->status = Status::Hooked;
+        }
+        restoreRuns();
+
+        PLH_LOG("Batch installed " + std::to_string(prepared.size()) + " detours over " +
+                std::to_string(runs.size()) + " page runs", ErrorLevel::INFO);
+        return prepared.size();
+    }
+}
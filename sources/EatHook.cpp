@@ -31,7 +31,6 @@ PLH::EatHook::EatHook(std::string apiName, std::wstring moduleName, const HMODUL
       , m_fnCallback(fnCallback)
       , m_origFunc(0)
       , m_userOrigVar(userOrigVar) // arbitrary, size is big enough but an overshoot
-      , m_allocator(64, 64)
       , m_trampoline(0)
       , m_moduleBase((uint64_t)moduleHandle)
 {
@@ -51,7 +50,9 @@ bool PLH::EatHook::hook()
     width jump to the final destination, and point the EAT to the stub.*/
     if (offset > std::numeric_limits<uint32_t>::max())
     {
-        m_trampoline = (uint64_t)m_allocator.allocate(m_moduleBase, calc_2gb_above(m_moduleBase));
+        // EAT entries are unsigned rvas, so the stub has to be above the module base
+        m_trampoline = NearCodeHeap::singleton().allocate(m_moduleBase, m_trampolineSize, m_moduleBase,
+                                                          calc_2gb_above(m_moduleBase));
         if (m_trampoline == 0)
         {
             PLH_LOG(
@@ -100,7 +101,7 @@ bool PLH::EatHook::unHook()
     // TODO: change hook to re-use existing trampoline rather than free-ing here to avoid overwrite later and dangling pointer
     if (m_trampoline)
     {
-        m_allocator.deallocate(m_trampoline);
+        NearCodeHeap::singleton().deallocate(m_trampoline);
         m_trampoline = 0;
     }
     return true;
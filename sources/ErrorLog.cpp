@@ -1,14 +1,40 @@
 #include "polyhook2/ErrorLog.hpp"
+#include "polyhook2/Misc.hpp"
 
 #if DEBUG_BUILD
 
 std::shared_ptr<PLH::Logger> PLH::Log::m_logger = nullptr;
+std::atomic<PLH::ErrorLevel> PLH::Log::m_level = PLH::ErrorLevel::INFO;
+
+std::string PLH::LogEvent::toString() const
+{
+    switch (kind)
+    {
+    case Kind::HookPrepared:
+        return "Hook prepared at " + int_to_hex(address) + " scheme: " + std::to_string(arg0) + " patch size: " +
+            std::to_string(arg1);
+    case Kind::TrampolineBuilt:
+        return "Trampoline " + int_to_hex(address) + " size: " + std::to_string(arg0) + " for " + int_to_hex(arg1);
+    default:
+        return std::string(msg, strnlen(msg, sizeof(msg)));
+    }
+}
+
+void PLH::Logger::logEvent(const LogEvent& event)
+{
+    log(event.toString(), event.level);
+}
 
 void PLH::Log::registerLogger(std::shared_ptr<Logger> logger)
 {
     m_logger = logger;
 }
 
+void PLH::Log::setLogLevel(const ErrorLevel level)
+{
+    m_level.store(level, std::memory_order_relaxed);
+}
+
 void PLH::Log::log(std::string msg, ErrorLevel level)
 {
     if (m_logger)
@@ -17,6 +43,14 @@ void PLH::Log::log(std::string msg, ErrorLevel level)
     }
 }
 
+void PLH::Log::logEvent(const LogEvent& event)
+{
+    if (m_logger)
+    {
+        m_logger->logEvent(event);
+    }
+}
+
 void PLH::ErrorLog::setLogLevel(ErrorLevel level)
 {
     m_logLevel = level;
@@ -29,24 +63,29 @@ void PLH::ErrorLog::log(const std::string& msg, ErrorLevel level)
 
 void PLH::ErrorLog::push(const Error& err)
 {
+    // only errors flush, a flush per line dominates hook install time
     if (err.lvl >= m_logLevel)
     {
         switch (err.lvl)
         {
         case ErrorLevel::INFO:
-            std::cout << "[+] Info: " << err.msg << std::endl;
+            std::cout << "[+] Info: " << err.msg << '\n';
             break;
         case ErrorLevel::WARN:
-            std::cout << "[!] Warn: " << err.msg << std::endl;
+            std::cout << "[!] Warn: " << err.msg << '\n';
             break;
         case ErrorLevel::SEV:
             std::cout << "[!] Error: " << err.msg << std::endl;
             break;
         default:
-            std::cout << "Unsupported error message logged " << err.msg << std::endl;
+            std::cout << "Unsupported error message logged " << err.msg << '\n';
         }
     }
 
+    if (m_log.size() == MAX_ERRORS)
+    {
+        m_log.pop_front();
+    }
     m_log.push_back(err);
 }
 
@@ -67,4 +106,131 @@ PLH::ErrorLog& PLH::ErrorLog::singleton()
     return log;
 }
 
+PLH::RingBufferLogger::RingBufferLogger(std::shared_ptr<Logger> sink, const size_t capacity)
+    : m_sink(std::move(sink))
+{
+    const size_t size = std::bit_ceil(std::max<size_t>(capacity, 2));
+    m_cells = std::make_unique<Cell[]>(size);
+    m_mask = size - 1;
+    for (size_t i = 0; i < size; i++)
+    {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    m_drainThread = std::thread(&RingBufferLogger::drain, this);
+}
+
+PLH::RingBufferLogger::~RingBufferLogger()
+{
+    m_stop.store(true, std::memory_order_release);
+    m_drainThread.join();
+}
+
+void PLH::RingBufferLogger::log(const std::string& msg, const ErrorLevel level)
+{
+    LogEvent event{};
+    event.level = level;
+    memcpy(event.msg, msg.data(), std::min(msg.size(), sizeof(event.msg) - 1));
+    logEvent(event);
+}
+
+void PLH::RingBufferLogger::logEvent(const LogEvent& event)
+{
+    if (!tryPush(event))
+    {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+uint64_t PLH::RingBufferLogger::getDropped() const
+{
+    return m_dropped.load(std::memory_order_relaxed);
+}
+
+// bounded MPMC queue, a cell's sequence says whose turn it is: pos when free for the producer at pos,
+// pos + 1 once filled for the consumer at pos
+bool PLH::RingBufferLogger::tryPush(const LogEvent& event)
+{
+    size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+    while (true)
+    {
+        Cell& cell = m_cells[pos & m_mask];
+        const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        const auto diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                cell.event = event;
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false; // full
+        }
+        else
+        {
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool PLH::RingBufferLogger::tryPop(LogEvent& event)
+{
+    size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+    while (true)
+    {
+        Cell& cell = m_cells[pos & m_mask];
+        const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        const auto diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+        if (diff == 0)
+        {
+            if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                event = cell.event;
+                cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false; // empty
+        }
+        else
+        {
+            pos = m_dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void PLH::RingBufferLogger::drain()
+{
+    LogEvent event{};
+    while (true)
+    {
+        // read stop first so nothing pushed before the destructor ran is left behind
+        const bool stop = m_stop.load(std::memory_order_acquire);
+        bool drained = false;
+        while (tryPop(event))
+        {
+            drained = true;
+            if (m_sink)
+            {
+                m_sink->logEvent(event);
+            }
+        }
+
+        if (stop)
+        {
+            return;
+        }
+
+        if (!drained)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
 #endif
@@ -0,0 +1,50 @@
+#include "polyhook2/HookEvents.hpp"
+
+namespace PLH
+{
+    HookEvents& HookEvents::singleton()
+    {
+        static HookEvents events;
+        return events;
+    }
+
+    uint64_t HookEvents::subscribe(const Subscriber& subscriber)
+    {
+        return m_dispatcher += subscriber;
+    }
+
+    void HookEvents::unsubscribe(const uint64_t id)
+    {
+        m_dispatcher -= id;
+    }
+
+    bool HookEvents::hasSubscribers() const
+    {
+        return (bool)m_dispatcher;
+    }
+
+    void HookEvents::publish(const HookEvent& event) const
+    {
+        if (m_dispatcher)
+        {
+            m_dispatcher.Invoke(event);
+        }
+    }
+
+    HookEvents::Start HookEvents::startTiming() const
+    {
+        if (!hasSubscribers())
+            return std::nullopt;
+        return std::chrono::steady_clock::now();
+    }
+
+    void HookEvents::publish(HookEvent event, const Start& start) const
+    {
+        if (!start)
+            return;
+
+        event.durationNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - *start).count();
+        publish(event);
+    }
+}
@@ -0,0 +1,94 @@
+#include "polyhook2/HookStats.hpp"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+namespace
+{
+    struct Sample
+    {
+        PLH::HookStats* stats;
+        uintptr_t returnAddress;
+        uint64_t start;
+    };
+
+    // deepest nesting of sampled calls per thread, deeper calls are counted but not timed
+    constexpr uint32_t MAX_DEPTH = 64;
+
+    /* calls in flight on this thread, innermost last. Nested and recursive hooks unwind in order. Plain
+       zero initialised storage so the hooked call path never allocates or runs a TLS constructor */
+    thread_local Sample t_samples[MAX_DEPTH];
+    thread_local uint32_t t_depth = 0;
+}
+
+namespace PLH
+{
+    uint64_t HookStats::getCalls() const
+    {
+        return m_calls.load(std::memory_order_relaxed);
+    }
+
+    uint64_t HookStats::getSamples() const
+    {
+        return m_samples.load(std::memory_order_relaxed);
+    }
+
+    uint64_t HookStats::getTotalTicks() const
+    {
+        return m_totalTicks.load(std::memory_order_relaxed);
+    }
+
+    uint64_t HookStats::getBucket(const size_t bucket) const
+    {
+        assert(bucket < BUCKETS);
+        return m_histogram[bucket].load(std::memory_order_relaxed);
+    }
+
+    std::array<uint64_t, HookStats::BUCKETS> HookStats::getHistogram() const
+    {
+        std::array<uint64_t, BUCKETS> histogram{};
+        for (size_t bucket = 0; bucket < BUCKETS; bucket++)
+        {
+            histogram[bucket] = getBucket(bucket);
+        }
+        return histogram;
+    }
+
+    void HookStats::reset()
+    {
+        m_calls.store(0, std::memory_order_relaxed);
+        m_samples.store(0, std::memory_order_relaxed);
+        m_totalTicks.store(0, std::memory_order_relaxed);
+        for (auto& bucket : m_histogram)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void HookStats::enter(HookStats* stats, uintptr_t* returnSlot)
+    {
+        // too deep, leave the return address alone so leave() isn't called for this one
+        if (t_depth == MAX_DEPTH)
+            return;
+
+        t_samples[t_depth++] = {stats, *returnSlot, __rdtsc()};
+        *returnSlot = stats->m_exitThunk;
+    }
+
+    uintptr_t HookStats::leave()
+    {
+        const uint64_t end = __rdtsc();
+        assert(t_depth > 0);
+        const Sample sample = t_samples[--t_depth];
+
+        const uint64_t ticks = end - sample.start;
+        const size_t bucket = std::min<size_t>(std::bit_width(ticks), BUCKETS - 1);
+        sample.stats->m_histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+        sample.stats->m_totalTicks.fetch_add(ticks, std::memory_order_relaxed);
+        sample.stats->m_samples.fetch_add(1, std::memory_order_relaxed);
+        return sample.returnAddress;
+    }
+}
@@ -1,5 +1,5 @@
 #include "polyhook2/Detour/ILCallback.hpp"
-#include "polyhook2/MemProtector.hpp"
+#include "polyhook2/Misc.hpp"
 
 asmjit::CallConvId PLH::ILCallback::getCallConv(const std::string& conv)
 {
@@ -15,6 +15,10 @@ asmjit::CallConvId PLH::ILCallback::getCallConv(const std::string& conv)
     {
         return asmjit::CallConvId::kFastCall;
     }
+    else if (conv == "vectorcall")
+    {
+        return asmjit::CallConvId::kVectorCall;
+    }
     return asmjit::CallConvId::kHost;
 }
 
@@ -66,14 +70,123 @@ asmjit::TypeId PLH::ILCallback::getTypeId(const std::string& type)
     {
         return asmjit::TypeId::kUIntPtr;
     }
+    else if (type == "__m128")
+    {
+        return asmjit::TypeId::kFloat32x4;
+    }
+    else if (type == "__m128d")
+    {
+        return asmjit::TypeId::kFloat64x2;
+    }
+    else if (type == "__m128i")
+    {
+        return asmjit::TypeId::kInt64x2;
+    }
+    else if (type == "__m256")
+    {
+        return asmjit::TypeId::kFloat32x8;
+    }
+    else if (type == "__m256d")
+    {
+        return asmjit::TypeId::kFloat64x4;
+    }
+    else if (type == "__m256i")
+    {
+        return asmjit::TypeId::kInt64x4;
+    }
 
     return asmjit::TypeId::kVoid;
 }
 
-uint64_t PLH::ILCallback::getJitFunc(const asmjit::FuncSignature& sig, const asmjit::Arch arch,
-                                     const PLH::ILCallback::tUserCallback callback)
+// offsets inside a stub template, every template is compiled as if placed at address 0
+struct PLH::ILCallback::StubTemplate
+{
+    std::vector<uint8_t> code;
+    std::vector<uint32_t> absFixups; // 32bit absolute addresses into the stub itself (x86), rebased on clone
+    uint32_t callbackSlot; // pointer sized slots the stub loads its per-callback targets from
+    uint32_t holderSlot;
+    uint32_t postCallbackSlot; // PrePost only
+};
+
+std::mutex PLH::ILCallback::m_stubTemplatesMutex;
+std::unordered_map<std::string, std::shared_ptr<const PLH::ILCallback::StubTemplate>> PLH::ILCallback::m_stubTemplates;
+
+namespace
+{
+    asmjit::JitAllocator::CreateParams dualMappedParams()
+    {
+        asmjit::JitAllocator::CreateParams params{};
+        params.options = asmjit::JitAllocatorOptions::kUseDualMapping;
+        return params;
+    }
+
+    /* Executable arena for the stubs, apart from the heap so no unrelated page ever changes protection.
+       Where the OS allows it pages are mapped twice, RX for execution and RW for writing, so stubs are
+       written without a single mprotect. Otherwise asmjit's RWX pages are used. */
+    asmjit::JitAllocator& stubAllocator()
+    {
+        static asmjit::JitAllocator::CreateParams params = dualMappedParams();
+        static asmjit::JitAllocator dualMapped(&params);
+        static asmjit::JitAllocator plain;
+        static asmjit::JitAllocator& chosen = []() -> asmjit::JitAllocator&
+        {
+            void* rx = nullptr;
+            void* rw = nullptr;
+            if (dualMapped.alloc(&rx, &rw, 16) == asmjit::kErrorOk)
+            {
+                dualMapped.release(rx);
+                return dualMapped;
+            }
+            return plain;
+        }();
+        return chosen;
+    }
+
+    // everything the generated code depends on: mode, arch, calling convention, return and argument types, structs
+    std::string stubTemplateKey(const asmjit::FuncSignature& sig, const std::vector<uint8_t>& argGroups,
+                                const asmjit::Arch arch, const PLH::ILCallback::CallbackMode mode)
+    {
+        std::string key;
+        key.push_back(static_cast<char>(mode));
+        key.push_back(static_cast<char>(arch));
+        key.push_back(static_cast<char>(sig.callConvId()));
+        key.push_back(static_cast<char>(sig.vaIndex()));
+        key.push_back(static_cast<char>(sig.ret()));
+        for (uint32_t argIdx = 0; argIdx < sig.argCount(); argIdx++)
+        {
+            key.push_back(static_cast<char>(sig.args()[argIdx]));
+        }
+        key.append(argGroups.begin(), argGroups.end());
+        return key;
+    }
+}
+
+std::shared_ptr<const PLH::ILCallback::StubTemplate> PLH::ILCallback::getStubTemplate(
+    const asmjit::FuncSignature& sig, const std::vector<uint8_t>& argGroups, const asmjit::Arch arch,
+    const CallbackMode mode) const
+{
+    const std::string key = stubTemplateKey(sig, argGroups, arch, mode);
+
+    // compiling under the lock keeps two threads from building the same shape twice
+    std::lock_guard<std::mutex> lock(m_stubTemplatesMutex);
+    if (const auto it = m_stubTemplates.find(key); it != m_stubTemplates.end())
+    {
+        return it->second;
+    }
+
+    auto stub = std::make_shared<StubTemplate>();
+    if (!compileStubTemplate(sig, argGroups, arch, mode, *stub))
+    {
+        return nullptr;
+    }
+
+    m_stubTemplates.emplace(key, stub);
+    return stub;
+}
+
+bool PLH::ILCallback::compileStubTemplate(const asmjit::FuncSignature& sig, const std::vector<uint8_t>& argGroups,
+                                          const asmjit::Arch arch, const CallbackMode mode, StubTemplate& stub) const
 {
-    ;
     /*AsmJit is smart enough to track register allocations and will forward
       the proper registers the right values and fixup any it dirtied earlier.
       This can only be done if it knows the signature, and ABI, so we give it 
@@ -89,6 +202,14 @@ uint64_t PLH::ILCallback::getJitFunc(const asmjit::FuncSignature& sig, const asm
       concrete physical registers will not have their liveness tracked, so will
       be spoiled and must be manually marked dirty. After endFunc ONLY concrete
       physical registers may be inserted as nodes.
+
+      The stub never embeds the user callback or the trampoline holder address. Both
+      are loaded from data slots after the code, so one compiled stub serves every
+      callback with the same signature and is only copied and patched per callback.
+
+      The Compiler has no tail calls, so the original is always called from the stub.
+      Observe saves work around that call instead, it neither reloads the arguments
+      nor round trips the return value through memory.
     */
     asmjit::CodeHolder code;
     auto env = asmjit::Environment::host();
@@ -99,6 +220,7 @@ uint64_t PLH::ILCallback::getJitFunc(const asmjit::FuncSignature& sig, const asm
     asmjit::x86::Compiler cc(&code);
     asmjit::FuncNode* func = cc.addFunc(sig);
 
+#if DEBUG_BUILD
     asmjit::StringLogger log;
     auto kFormatFlags =
         asmjit::FormatFlags::kMachineCode | asmjit::FormatFlags::kExplainImms | asmjit::FormatFlags::kRegCasts
@@ -106,17 +228,34 @@ uint64_t PLH::ILCallback::getJitFunc(const asmjit::FuncSignature& sig, const asm
 
     log.addFlags(kFormatFlags);
     code.setLogger(&log);
+#endif
+
+    const asmjit::Label callbackSlot = cc.newLabel();
+    const asmjit::Label holderSlot = cc.newLabel();
+    const asmjit::Label postCallbackSlot = cc.newLabel();
 
     // too small to really need it
     func->frame().resetPreservedFP();
 
-    // map argument slots to registers, following abi.
+    const asmjit::Label offsetTable = cc.newLabel();
+
+    // wide vectors only have one well defined register convention on x64, Win64 passes them by reference
+    const bool vectorsInRegs = arch == asmjit::Arch::kX64 && (!env.isPlatformWindows() || sig.callConvId() == asmjit::CallConvId::kVectorCall);
+
+    // map argument slots to registers, following abi. Each argument gets a slot as wide as its register
+    // and aligned to that width, parts of one struct share a group and lie back to back.
     std::vector<asmjit::x86::Reg> argRegisters;
+    std::vector<uint32_t> argOffsets;
+    std::vector<uint16_t> groupOffsets;
+    uint32_t stackSize = 0;
+    uint32_t stackAlign = 16;
     for (uint8_t argIdx = 0; argIdx < sig.argCount(); argIdx++)
     {
         const auto argType = sig.args()[argIdx];
+        const uint8_t group = argGroups.empty() ? argIdx : argGroups[argIdx];
 
         asmjit::x86::Reg arg;
+        uint32_t slotSize = sizeof(uint64_t);
         if (isGeneralReg(argType))
         {
             arg = cc.newUIntPtr();
@@ -125,107 +264,148 @@ uint64_t PLH::ILCallback::getJitFunc(const asmjit::FuncSignature& sig, const asm
         {
             arg = cc.newXmm();
         }
+        else if (isVecReg(argType) && vectorsInRegs)
+        {
+            slotSize = asmjit::TypeUtils::sizeOf(argType);
+            arg = slotSize == 32 ? asmjit::x86::Reg(cc.newYmm()) : asmjit::x86::Reg(cc.newXmm());
+            stackAlign = std::max(stackAlign, slotSize);
+        }
         else
         {
-            PLH_LOG("Parameters wider than 64bits not supported", ErrorLevel::SEV);
-            return 0;
+            PLH_LOG("Parameter type not supported by this calling convention", ErrorLevel::SEV);
+            return false;
         }
 
+        if (group == groupOffsets.size())
+        {
+            stackSize = (uint32_t)AlignUpwards(stackSize, slotSize);
+            groupOffsets.push_back((uint16_t)stackSize);
+        }
+        argOffsets.push_back(stackSize);
+        stackSize += slotSize;
+
         func->setArg(argIdx, arg);
         argRegisters.push_back(arg);
     }
 
-    // setup the stack structure to hold arguments for user callback
-    uint32_t stackSize = (uint32_t)(sizeof(uint64_t) * sig.argCount());
-    argsStack = cc.newStack(stackSize, 16);
-    asmjit::x86::Mem argsStackIdx(argsStack);
+    if (sig.hasRet() && !isGeneralReg(sig.ret()) && !isXmmReg(sig.ret()))
+    {
+        PLH_LOG("Return values wider than 64bits not supported", ErrorLevel::SEV);
+        return false;
+    }
 
-    // assigns some register as index reg 
-    asmjit::x86::Gp i = cc.newUIntPtr();
+    /* setup the stack structure to hold arguments for user callback. A header in front of the slots holds
+       the pointer to the offset table Parameters uses to find them, the header keeps the slots aligned.*/
+    asmjit::x86::Mem argsArea = cc.newStack(stackAlign + stackSize, stackAlign);
+    asmjit::x86::Mem argsStack = argsArea.cloneAdjusted(stackAlign);
 
-    // stackIdx <- stack[i].
-    argsStackIdx.setIndex(i);
+    asmjit::x86::Mem offsetTablePtr = argsStack.cloneAdjusted(-(int32_t)sizeof(uint64_t));
+    asmjit::x86::Gp offsetTableAddress = cc.newUIntPtr("offsetTable");
+    cc.lea(offsetTableAddress, asmjit::x86::ptr(offsetTable));
+    cc.mov(offsetTablePtr, offsetTableAddress);
 
-    // r/w are sizeof(uint64_t) width now
-    argsStackIdx.setSize(sizeof(uint64_t));
+    // slots are at constant offsets, r/w are the width of the register
+    auto argSlot = [&](const uint8_t argIdx)
+    {
+        asmjit::x86::Mem slot = argsStack.cloneAdjusted(argOffsets[argIdx]);
+        slot.setSize(isVecReg(sig.args()[argIdx]) ? asmjit::TypeUtils::sizeOf(sig.args()[argIdx]) : sizeof(uint64_t));
+        return slot;
+    };
 
-    // set i = 0
-    cc.mov(i, 0);
-    //// mov from arguments registers into the stack structure
-    for (uint8_t argIdx = 0; argIdx < sig.argCount(); argIdx++)
+    // have to cast back to explicit register types to gen right mov type
+    auto storeArg = [&](const uint8_t argIdx)
     {
         const auto argType = sig.args()[argIdx];
+        const asmjit::x86::Reg& arg = argRegisters.at(argIdx);
+        if (isGeneralReg(argType))
+        {
+            cc.mov(argSlot(argIdx), arg.as<asmjit::x86::Gp>());
+        }
+        else if (isXmmReg(argType))
+        {
+            cc.movq(argSlot(argIdx), arg.as<asmjit::x86::Xmm>());
+        }
+        else if (arg.isYmm())
+        {
+            cc.vmovaps(argSlot(argIdx), arg.as<asmjit::x86::Ymm>());
+        }
+        else
+        {
+            cc.movaps(argSlot(argIdx), arg.as<asmjit::x86::Xmm>());
+        }
+    };
 
-        // have to cast back to explicit register types to gen right mov type
+    auto loadArg = [&](const uint8_t argIdx)
+    {
+        const auto argType = sig.args()[argIdx];
+        const asmjit::x86::Reg& arg = argRegisters.at(argIdx);
         if (isGeneralReg(argType))
         {
-            cc.mov(argsStackIdx, argRegisters.at(argIdx).as<asmjit::x86::Gp>());
+            cc.mov(arg.as<asmjit::x86::Gp>(), argSlot(argIdx));
         }
         else if (isXmmReg(argType))
         {
-            cc.movq(argsStackIdx, argRegisters.at(argIdx).as<asmjit::x86::Xmm>());
+            cc.movq(arg.as<asmjit::x86::Xmm>(), argSlot(argIdx));
+        }
+        else if (arg.isYmm())
+        {
+            cc.vmovaps(arg.as<asmjit::x86::Ymm>(), argSlot(argIdx));
         }
         else
         {
-            PLH_LOG("Parameters wider than 64bits not supported", ErrorLevel::SEV);
-            return 0;
+            cc.movaps(arg.as<asmjit::x86::Xmm>(), argSlot(argIdx));
         }
+    };
 
-        // next structure slot (+= sizeof(uint64_t))
-        cc.add(i, sizeof(uint64_t));
+    //// mov from arguments registers into the stack structure
+    for (uint8_t argIdx = 0; argIdx < sig.argCount(); argIdx++)
+    {
+        storeArg(argIdx);
     }
 
     // get pointer to stack structure and pass it to the user callback
     asmjit::x86::Gp argStruct = cc.newUIntPtr("argStruct");
     cc.lea(argStruct, argsStack);
 
-    // fill reg to pass struct arg count to callback
+    // fill reg to pass struct arg count to callback, structs count once
     asmjit::x86::Gp argCountParam = cc.newUInt8();
-    cc.mov(argCountParam, (uint8_t)sig.argCount());
+    cc.mov(argCountParam, (uint8_t)groupOffsets.size());
 
     // create buffer for ret val
     asmjit::x86::Mem retStack = cc.newStack(sizeof(uint64_t), 16);
+    retStack.setSize(sizeof(uint64_t));
     asmjit::x86::Gp retStruct = cc.newUIntPtr("retStruct");
     cc.lea(retStruct, retStack);
 
-    asmjit::InvokeNode* invokeNode;
-    cc.invoke(&invokeNode,
-              (uint64_t)callback,
-              asmjit::FuncSignatureT<void, Parameters*, uint8_t, ReturnValue*>()
-    );
-
-    // call to user provided function (use ABI of host compiler)
-    invokeNode->setArg(0, argStruct);
-    invokeNode->setArg(1, argCountParam);
-    invokeNode->setArg(2, retStruct);
-
-    // mov from arguments stack structure into regs
-    cc.mov(i, 0); // reset idx
-    for (uint8_t arg_idx = 0; arg_idx < sig.argCount(); arg_idx++)
+    // call to user provided function loaded from its data slot (use ABI of host compiler)
+    auto invokeCallback = [&](const asmjit::Label& slot, const char* name)
     {
-        const auto argType = sig.args()[arg_idx];
-
-        if (isGeneralReg(argType))
-        {
-            cc.mov(argRegisters.at(arg_idx).as<asmjit::x86::Gp>(), argsStackIdx);
-        }
-        else if (isXmmReg(argType))
-        {
-            cc.movq(argRegisters.at(arg_idx).as<asmjit::x86::Xmm>(), argsStackIdx);
-        }
-        else
+        asmjit::x86::Gp callbackPtr = cc.newUIntPtr(name);
+        cc.mov(callbackPtr, asmjit::x86::ptr(slot));
+
+        asmjit::InvokeNode* invokeNode;
+        cc.invoke(&invokeNode,
+                  callbackPtr,
+                  asmjit::FuncSignatureT<void, Parameters*, uint8_t, ReturnValue*>()
+        );
+        invokeNode->setArg(0, argStruct);
+        invokeNode->setArg(1, argCountParam);
+        invokeNode->setArg(2, retStruct);
+    };
+    invokeCallback(callbackSlot, "callback");
+
+    // mov from arguments stack structure into regs, observers can't change them so the live registers are reused
+    if (mode != CallbackMode::Observe)
+    {
+        for (uint8_t argIdx = 0; argIdx < sig.argCount(); argIdx++)
         {
-            PLH_LOG("Parameters wider than 64bits not supported", ErrorLevel::SEV);
-            return 0;
+            loadArg(argIdx);
         }
-
-        // next structure slot (+= sizeof(uint64_t))
-        cc.add(i, sizeof(uint64_t));
     }
 
     // deref the trampoline ptr (holder must live longer, must be concrete reg since push later)
     asmjit::x86::Gp origPtr = cc.zbx();
-    cc.mov(origPtr, (uintptr_t)getTrampolineHolder());
+    cc.mov(origPtr, asmjit::x86::ptr(holderSlot));
     cc.mov(origPtr, asmjit::x86::ptr(origPtr));
 
     asmjit::InvokeNode* origInvokeNode;
@@ -237,71 +417,300 @@ uint64_t PLH::ILCallback::getJitFunc(const asmjit::FuncSignature& sig, const asm
 
     if (sig.hasRet())
     {
-        asmjit::x86::Mem retStackIdx(retStack);
-        retStackIdx.setSize(sizeof(uint64_t));
-        if (isGeneralReg(sig.ret()))
+        const bool gpRet = isGeneralReg(sig.ret());
+        asmjit::x86::Reg retReg;
+        if (gpRet)
         {
-            asmjit::x86::Gp tmp2 = cc.newUIntPtr();
-            cc.mov(tmp2, retStackIdx);
-            cc.ret(tmp2);
+            retReg = cc.newUIntPtr("ret");
         }
         else
         {
-            asmjit::x86::Xmm tmp2 = cc.newXmm();
-            cc.movq(tmp2, retStackIdx);
-            cc.ret(tmp2);
+            retReg = cc.newXmm("ret");
+        }
+
+        // Modify returns whatever the callback left in the ReturnValue, the original's result is dropped
+        if (mode != CallbackMode::Modify)
+        {
+            origInvokeNode->setRet(0, retReg);
+        }
+
+        if (mode == CallbackMode::PrePost)
+        {
+            if (gpRet)
+            {
+                cc.mov(retStack, retReg.as<asmjit::x86::Gp>());
+            }
+            else
+            {
+                cc.movq(retStack, retReg.as<asmjit::x86::Xmm>());
+            }
+            invokeCallback(postCallbackSlot, "postCallback");
         }
+
+        if (mode != CallbackMode::Observe)
+        {
+            if (gpRet)
+            {
+                cc.mov(retReg.as<asmjit::x86::Gp>(), retStack);
+            }
+            else
+            {
+                cc.movq(retReg.as<asmjit::x86::Xmm>(), retStack);
+            }
+        }
+        cc.ret(retReg);
+    }
+    else if (mode == CallbackMode::PrePost)
+    {
+        invokeCallback(postCallbackSlot, "postCallback");
     }
 
     cc.func()->frame().addDirtyRegs(origPtr);
 
     cc.endFunc();
 
+    // per-callback data, filled in when the template is cloned
+    const uint64_t emptySlot = 0;
+    cc.align(asmjit::AlignMode::kData, sizeof(uint64_t));
+    cc.bind(callbackSlot);
+    cc.embed(&emptySlot, sizeof(emptySlot));
+    cc.bind(holderSlot);
+    cc.embed(&emptySlot, sizeof(emptySlot));
+    if (mode == CallbackMode::PrePost)
+    {
+        cc.bind(postCallbackSlot);
+        cc.embed(&emptySlot, sizeof(emptySlot));
+    }
+
+    // argument index -> slot offset, read by Parameters
+    cc.bind(offsetTable);
+    if (!groupOffsets.empty())
+    {
+        cc.embed(groupOffsets.data(), groupOffsets.size() * sizeof(uint16_t));
+    }
+
     // write to buffer
     cc.finalize();
 
-    // worst case, overestimates for case trampolines needed
     code.flatten();
-    size_t size = code.codeSize();
 
-    // Allocate a virtual memory (executable).
-    m_callbackBuf = (uint64_t)new char[size];
-    if (!m_callbackBuf)
+    // if multiple sections, resolve linkage (1 atm)
+    if (code.hasUnresolvedLinks())
     {
-        PolyHook2DebugBreak();
+        code.resolveUnresolvedLinks();
+    }
+
+    // x64 reaches the slots rip relative. x86 addresses them absolutely, those fields are
+    // rebased on every clone. Anything else would tie the code to one address
+    for (const asmjit::RelocEntry* reloc : code.relocEntries())
+    {
+        if (reloc->relocType() != asmjit::RelocType::kRelToAbs || reloc->format().valueSize() != sizeof(uint32_t))
+        {
+            PLH_LOG("JIT stub has a relocation that can't be rebased", ErrorLevel::SEV);
+            return false;
+        }
+        stub.absFixups.push_back(static_cast<uint32_t>(reloc->sourceOffset() + reloc->format().valueOffset()));
+    }
+
+    code.relocateToBase(0);
+    stub.code.resize(code.codeSize());
+    code.copyFlattenedData(stub.code.data(), stub.code.size());
+    stub.callbackSlot = static_cast<uint32_t>(code.labelOffsetFromBase(callbackSlot));
+    stub.holderSlot = static_cast<uint32_t>(code.labelOffsetFromBase(holderSlot));
+    stub.postCallbackSlot = mode == CallbackMode::PrePost
+                                ? static_cast<uint32_t>(code.labelOffsetFromBase(postCallbackSlot))
+                                : 0;
+
+#if DEBUG_BUILD
+    PLH_LOG("JIT Stub template:\n" + std::string(log.data()), ErrorLevel::INFO);
+#endif
+    return true;
+}
+
+uint64_t PLH::ILCallback::getJitFunc(const asmjit::FuncSignature& sig, const asmjit::Arch arch,
+                                     const PLH::ILCallback::tUserCallback callback, const CallbackMode mode,
+                                     const PLH::ILCallback::tUserCallback postCallback/* = nullptr*/)
+{
+    return makeJitFunc(sig, {}, arch, callback, mode, postCallback);
+}
+
+uint64_t PLH::ILCallback::makeJitFunc(const asmjit::FuncSignature& sig, const std::vector<uint8_t>& argGroups,
+                                      const asmjit::Arch arch, const tUserCallback callback, const CallbackMode mode,
+                                      const tUserCallback postCallback)
+{
+    if (mode == CallbackMode::PrePost && !postCallback)
+    {
+        PLH_LOG("PrePost callbacks need a post callback", ErrorLevel::SEV);
         return 0;
     }
 
-    MemoryProtector protector(m_callbackBuf, size, ProtFlag::R | ProtFlag::W | ProtFlag::X, *this, false);
+    const auto stub = getStubTemplate(sig, argGroups, arch, mode);
+    if (!stub)
+    {
+        return 0;
+    }
 
-    // if multiple sections, resolve linkage (1 atm)
-    if (code.hasUnresolvedLinks())
+    // the stub from an earlier call may still be jumped to by a detour, keep it until the ILCallback is destroyed
+    if (m_callbackBuf)
     {
-        code.resolveUnresolvedLinks();
+        m_retiredStubs.push_back(m_callbackBuf);
+        m_callbackBuf = 0;
+    }
+
+    // clone the template, rebase its self references and fill in the targets of this callback
+    std::vector<uint8_t> code = stub->code;
+    void* rx = nullptr;
+    void* rw = nullptr;
+    if (stubAllocator().alloc(&rx, &rw, code.size()) != asmjit::kErrorOk)
+    {
+        PLH_LOG("Failed to allocate JIT stub memory", ErrorLevel::SEV);
+        return 0;
+    }
+    m_callbackBuf = (uint64_t)rx;
+
+    for (const uint32_t fixup : stub->absFixups)
+    {
+        uint32_t value;
+        memcpy(&value, code.data() + fixup, sizeof(value));
+        value += static_cast<uint32_t>(m_callbackBuf);
+        memcpy(code.data() + fixup, &value, sizeof(value));
     }
 
-    // Relocate to the base-address of the allocated memory.
-    code.relocateToBase(m_callbackBuf);
-    code.copyFlattenedData((unsigned char*)m_callbackBuf, size);
+    const uint64_t callbackAddress = (uint64_t)callback;
+    const uint64_t holderAddress = (uint64_t)getTrampolineHolder();
+    memcpy(code.data() + stub->callbackSlot, &callbackAddress, sizeof(callbackAddress));
+    memcpy(code.data() + stub->holderSlot, &holderAddress, sizeof(holderAddress));
+    if (mode == CallbackMode::PrePost)
+    {
+        const uint64_t postCallbackAddress = (uint64_t)postCallback;
+        memcpy(code.data() + stub->postCallbackSlot, &postCallbackAddress, sizeof(postCallbackAddress));
+    }
+
+    // the finished stub goes out in one write through the writable view
+    memcpy(rw, code.data(), code.size());
+    asmjit::VirtMem::flushInstructionCache(rx, code.size());
 
-    PLH_LOG("JIT Stub:\n" + std::string(log.data()), ErrorLevel::INFO);
+    PLH_LOG("JIT Stub: " + int_to_hex(m_callbackBuf), ErrorLevel::INFO);
     return m_callbackBuf;
 }
 
 uint64_t PLH::ILCallback::getJitFunc(const std::string& retType, const std::vector<std::string>& paramTypes,
                                      const asmjit::Arch arch, const tUserCallback callback,
-                                     std::string callConv/* = ""*/)
+                                     std::string callConv/* = ""*/, const CallbackMode mode/* = Modify*/,
+                                     const tUserCallback postCallback/* = nullptr*/)
 {
-    std::vector<TypeId> typeIds;
-    for (const std::string& s : paramTypes)
+    // structs are split into the registers they travel in, argGroups maps those back to the parameter
+    std::vector<asmjit::TypeId> typeIds;
+    std::vector<uint8_t> argGroups;
+    bool hasStruct = false;
+
+    // SysV only passes a struct in registers if all of it fits in the ones left
+    const bool sysV = arch == asmjit::Arch::kX64 && !asmjit::Environment::host().isPlatformWindows();
+    uint8_t gpLeft = 6;
+    uint8_t xmmLeft = 8;
+    for (uint8_t paramIdx = 0; paramIdx < paramTypes.size(); paramIdx++)
     {
-        typeIds.emplace_back(getTypeId(s));
+        std::vector<asmjit::TypeId> parts;
+        if (paramTypes[paramIdx].rfind("struct", 0) == 0)
+        {
+            if (!classifyStruct(paramTypes[paramIdx], arch, parts))
+            {
+                return 0;
+            }
+            hasStruct = true;
+        }
+        else
+        {
+            parts.push_back(getTypeId(paramTypes[paramIdx]));
+        }
+
+        const uint8_t gpNeeded = (uint8_t)std::count_if(parts.begin(), parts.end(),
+                                                        [this](const asmjit::TypeId t) { return isGeneralReg(t); });
+        const uint8_t xmmNeeded = (uint8_t)(parts.size() - gpNeeded);
+        if (sysV && parts.size() > 1 && (gpNeeded > gpLeft || xmmNeeded > xmmLeft))
+        {
+            PLH_LOG("Struct parameters passed on the stack not supported", ErrorLevel::SEV);
+            return 0;
+        }
+        gpLeft -= std::min(gpLeft, gpNeeded);
+        xmmLeft -= std::min(xmmLeft, xmmNeeded);
+
+        typeIds.insert(typeIds.end(), parts.begin(), parts.end());
+        argGroups.insert(argGroups.end(), parts.size(), paramIdx);
     }
 
     asmjit::FuncSignature sig{};
-    sig.init(getCallConv(callConv), 0, getTypeId(retType), typeIds.data(), asmjit::FuncSignature::kNoVarArgs);
+    sig.init(getCallConv(callConv), asmjit::FuncSignature::kNoVarArgs, getTypeId(retType), typeIds.data(), (uint32_t)typeIds.size());
+
+    return makeJitFunc(sig, hasStruct ? argGroups : std::vector<uint8_t>{}, arch, callback, mode, postCallback);
+}
+
+bool PLH::ILCallback::classifyStruct(const std::string& type, const asmjit::Arch arch,
+                                     std::vector<asmjit::TypeId>& parts) const
+{
+    const size_t open = type.find('{');
+    const size_t close = type.rfind('}');
+    if (open == std::string::npos || close == std::string::npos || close < open)
+    {
+        PLH_LOG("Malformed struct type " + type, ErrorLevel::SEV);
+        return false;
+    }
+
+    // lay the fields out with natural alignment, remembering which eightbytes hold integers
+    uint32_t size = 0;
+    uint32_t align = 1;
+    bool integerEightbyte[2] = {false, false};
+    std::stringstream fields(type.substr(open + 1, close - open - 1));
+    std::string field;
+    while (std::getline(fields, field, ','))
+    {
+        field.erase(0, field.find_first_not_of(' '));
+        field.erase(field.find_last_not_of(' ') + 1);
+
+        const asmjit::TypeId fieldType = getTypeId(field);
+        if (!isGeneralReg(fieldType) && !isXmmReg(fieldType))
+        {
+            PLH_LOG("Unsupported struct field " + field, ErrorLevel::SEV);
+            return false;
+        }
+
+        const uint32_t fieldSize = asmjit::TypeUtils::sizeOf(fieldType);
+        size = (uint32_t)AlignUpwards(size, fieldSize);
+        if (size + fieldSize <= 2 * sizeof(uint64_t) && isGeneralReg(fieldType))
+        {
+            integerEightbyte[size / sizeof(uint64_t)] = true;
+        }
+        size += fieldSize;
+        align = std::max(align, fieldSize);
+    }
+    size = (uint32_t)AlignUpwards(size, align);
+
+    if (arch != asmjit::Arch::kX64)
+    {
+        PLH_LOG("Struct parameters passed on the stack not supported", ErrorLevel::SEV);
+        return false;
+    }
+
+    // Win64: 1, 2, 4 and 8 byte structs go in a gp register, anything else by reference
+    if (asmjit::Environment::host().isPlatformWindows())
+    {
+        const bool inRegister = size == 1 || size == 2 || size == 4 || size == 8;
+        parts.push_back(inRegister ? asmjit::TypeId::kUInt64 : asmjit::TypeId::kUIntPtr);
+        return true;
+    }
+
+    // SysV: up to two eightbytes, each INTEGER if any field in it is, SSE otherwise. Larger ones are MEMORY
+    if (size == 0 || size > 2 * sizeof(uint64_t))
+    {
+        PLH_LOG("Struct parameters passed on the stack not supported", ErrorLevel::SEV);
+        return false;
+    }
 
-    return getJitFunc(sig, arch, callback);
+    for (uint32_t eightbyte = 0; eightbyte * sizeof(uint64_t) < size; eightbyte++)
+    {
+        parts.push_back(integerEightbyte[eightbyte] ? asmjit::TypeId::kUInt64 : asmjit::TypeId::kFloat64);
+    }
+    return true;
 }
 
 uint64_t* PLH::ILCallback::getTrampolineHolder()
@@ -329,6 +738,11 @@ bool PLH::ILCallback::isGeneralReg(const asmjit::TypeId typeId) const
     }
 }
 
+bool PLH::ILCallback::isVecReg(const asmjit::TypeId typeId) const
+{
+    return asmjit::TypeUtils::isVec128(typeId) || asmjit::TypeUtils::isVec256(typeId);
+}
+
 bool PLH::ILCallback::isXmmReg(const asmjit::TypeId typeId) const
 {
     switch (typeId)
@@ -349,4 +763,20 @@ PLH::ILCallback::ILCallback()
 
 PLH::ILCallback::~ILCallback()
 {
+    releaseJitFunc();
+}
+
+void PLH::ILCallback::releaseJitFunc()
+{
+    if (m_callbackBuf)
+    {
+        stubAllocator().release((void*)m_callbackBuf);
+        m_callbackBuf = 0;
+    }
+
+    for (const uint64_t stub : m_retiredStubs)
+    {
+        stubAllocator().release((void*)stub);
+    }
+    m_retiredStubs.clear();
 }
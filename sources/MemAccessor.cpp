@@ -1,5 +1,6 @@
 #include "polyhook2/MemAccessor.hpp"
 #include "polyhook2/MemProtector.hpp"
+#include "polyhook2/MemRegionMap.hpp"
 #include "polyhook2/Misc.hpp"
 
 #include "polyhook2/PolyHookOsIncludes.hpp"
@@ -46,6 +47,13 @@ PLH::ProtFlag PLH::MemAccessor::mem_protect(uint64_t dest, uint64_t size, ProtFl
 {
     DWORD orig;
     status = VirtualProtect((char*)dest, static_cast<SIZE_T>(size), TranslateProtection(prot), &orig) != 0;
+    if (status)
+    {
+        // VirtualProtect changes every page the range touches, keep the cached map in step
+        const uint64_t pageSize = getPageSize();
+        MemRegionMap::singleton().setProtection(MEMORY_ROUND(dest, pageSize), MEMORY_ROUND_UP(dest + size, pageSize),
+                                                prot);
+    }
     return TranslateProtection(orig);
 }
 
@@ -58,38 +66,53 @@ struct region_t {
 };
 
 static region_t get_region_from_addr(uint64_t addr) {
-	region_t res{};
-
-	std::ifstream f("/proc/self/maps");
-	std::string s;
-	while (std::getline(f, s)) {
-		if (!s.empty() && s.find("vdso") == std::string::npos && s.find("vsyscall") == std::string::npos)
-		{
-			char* strend = &s[0];
-			uint64_t start = strtoul(strend  , &strend, 16);
-			uint64_t end   = strtoul(strend+1, &strend, 16);
-			if (start != 0 && end != 0 && start <= addr && addr < end) {
-				res.start = start;
-				res.end = end;
-
-				++strend;
-				if (strend[0] == 'r')
-					res.prot = res.prot | PLH::ProtFlag::R;
-	
-				if (strend[1] == 'w')
-					res.prot = res.prot | PLH::ProtFlag::W;
-	
-				if (strend[2] == 'x')
-					res.prot = res.prot | PLH::ProtFlag::X;
-
-				if(res.prot == PLH::ProtFlag::UNSET)
-					res.prot = PLH::ProtFlag::NONE;
-
-				break;
-			}
-		}
+	// served from the cached map, /proc/self/maps is only re-read when the snapshot is stale
+	const auto region = PLH::MemRegionMap::singleton().find(addr);
+	if (!region)
+		return region_t{};
+
+	return region_t{region->start, region->end, region->prot};
+}
+
+// copy that reports a fault instead of taking it, the cached map may not know about memory other code
+// unmapped or re-protected. Returns the bytes copied, a short count stops at the first bad page
+static bool checked_copy(uint64_t dest, uint64_t src, uint64_t size, size_t& copied) {
+	iovec local{(void*)dest, (size_t)size};
+	iovec remote{(void*)src, (size_t)size};
+	const ssize_t res = process_vm_readv(getpid(), &local, 1, &remote, 1, 0);
+	if (res >= 0) {
+		copied = (size_t)res;
+		return copied > 0;
 	}
-	return res;
+
+	// filtered by a seccomp policy, fall back to trusting the map
+	if (errno == ENOSYS || errno == EPERM) {
+		memcpy((void*)dest, (void*)src, (size_t)size);
+		copied = size;
+		return true;
+	}
+	copied = 0;
+	return false;
+}
+
+// check src against the cached map and copy, once more with a fresh map if either fails
+static bool safe_copy(uint64_t dest, uint64_t src, uint64_t size, PLH::ProtFlag required, size_t& copied) {
+	copied = 0;
+	for (int attempt = 0; attempt < 2; attempt++) {
+		if (attempt > 0)
+			PLH::MemRegionMap::singleton().invalidate();
+
+		const region_t region_infos = get_region_from_addr(src);
+		if (region_infos.end == 0)
+			return false; // not in the map even after it asked the OS
+
+		if (!(region_infos.prot & required))
+			continue;
+
+		if (checked_copy(dest, src, std::min<uint64_t>(region_infos.end - src, size), copied))
+			return true;
+	}
+	return false;
 }
 
 bool PLH::MemAccessor::mem_copy(uint64_t dest, uint64_t src, uint64_t size) const {
@@ -98,33 +121,13 @@ bool PLH::MemAccessor::mem_copy(uint64_t dest, uint64_t src, uint64_t size) cons
 }
 
 bool PLH::MemAccessor::safe_mem_write(uint64_t dest, uint64_t src, uint64_t size, size_t& written) const noexcept {
-	region_t region_infos = get_region_from_addr(src);
-	
 	// Make sure that the region we query is writable
-	if(!(region_infos.prot & PLH::ProtFlag::W))
-		return false;
-	
-	size = std::min<uint64_t>(region_infos.end - src, size);
-	
-	memcpy((void*)dest, (void*)src, (size_t)size);
-	written = size;
-
-	return true;
+	return safe_copy(dest, src, size, PLH::ProtFlag::W, written);
 }
 
 bool PLH::MemAccessor::safe_mem_read(uint64_t src, uint64_t dest, uint64_t size, size_t& read) const noexcept {
-	region_t region_infos = get_region_from_addr(src);
-	
 	// Make sure that the region we query is readable
-	if(!(region_infos.prot & PLH::ProtFlag::R))
-		return false;
-
-	size = std::min<uint64_t>(region_infos.end - src, size);
-
-	memcpy((void*)dest, (void*)src, (size_t)size);
-	read = size;
-
-	return true;
+	return safe_copy(dest, src, size, PLH::ProtFlag::R, read);
 }
 
 PLH::ProtFlag PLH::MemAccessor::mem_protect(uint64_t dest, uint64_t size, PLH::ProtFlag prot, bool& status) const {
@@ -132,6 +135,8 @@ PLH::ProtFlag PLH::MemAccessor::mem_protect(uint64_t dest, uint64_t size, PLH::P
 	uint64_t aligned_dest = MEMORY_ROUND(dest, PLH::getPageSize());
 	uint64_t aligned_size = MEMORY_ROUND_UP(size, PLH::getPageSize());
 	status = mprotect((void*)aligned_dest, aligned_size, TranslateProtection(prot)) == 0;
+	if (status)
+		PLH::MemRegionMap::singleton().setProtection(aligned_dest, aligned_dest + aligned_size, prot);
 	return region_infos.prot;
 }
 
@@ -0,0 +1,224 @@
+#include "polyhook2/MemRegionMap.hpp"
+#include "polyhook2/MemProtector.hpp"
+#include "polyhook2/PolyHookOsIncludes.hpp"
+
+#include <cerrno>
+
+PLH::MemRegionMap& PLH::MemRegionMap::singleton()
+{
+    static MemRegionMap map;
+    return map;
+}
+
+std::vector<PLH::MemRegion>::const_iterator PLH::MemRegionMap::lookup(uint64_t addr) const
+{
+    // first region that ends after addr, it contains addr if it also starts at or before it
+    const auto it = std::upper_bound(m_regions.begin(), m_regions.end(), addr,
+                                     [](uint64_t a, const MemRegion& r) { return a < r.end; });
+    if (it != m_regions.end() && it->start <= addr)
+        return it;
+    return m_regions.end();
+}
+
+std::optional<PLH::MemRegion> PLH::MemRegionMap::find(uint64_t addr)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stale)
+        refresh();
+
+    auto it = lookup(addr);
+    if (it == m_regions.end() && isMapped(addr))
+    {
+        // mapped after our snapshot was taken
+        refresh();
+        it = lookup(addr);
+    }
+
+    if (it == m_regions.end())
+        return {};
+    return *it;
+}
+
+std::vector<PLH::MemRegion> PLH::MemRegionMap::regions(uint64_t start, uint64_t end)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stale)
+        refresh();
+
+    std::vector<MemRegion> out;
+    auto it = std::upper_bound(m_regions.begin(), m_regions.end(), start,
+                               [](uint64_t a, const MemRegion& r) { return a < r.end; });
+    for (; it != m_regions.end() && it->start < end; ++it)
+    {
+        out.push_back(*it);
+    }
+    return out;
+}
+
+void PLH::MemRegionMap::setProtection(uint64_t start, uint64_t end, ProtFlag prot)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stale)
+        return; // next lookup re-reads anyway
+
+    std::vector<MemRegion> updated;
+    updated.reserve(m_regions.size() + 2);
+    for (const auto& r : m_regions)
+    {
+        if (r.end <= start || r.start >= end)
+        {
+            updated.push_back(r);
+            continue;
+        }
+
+        // split into the untouched head, the re-protected middle and the untouched tail
+        if (r.start < start)
+            updated.push_back({r.start, start, r.prot, r.kernel});
+
+        updated.push_back({std::max(r.start, start), std::min(r.end, end), prot, r.kernel});
+
+        if (r.end > end)
+            updated.push_back({end, r.end, r.prot, r.kernel});
+    }
+
+    // undo the splits of earlier changes once protections match again, like the kernel merges its mappings
+    m_regions.clear();
+    for (const auto& r : updated)
+    {
+        if (!m_regions.empty() && m_regions.back().end == r.start && m_regions.back().prot == r.prot &&
+            !m_regions.back().kernel && !r.kernel)
+        {
+            m_regions.back().end = r.end;
+            continue;
+        }
+        m_regions.push_back(r);
+    }
+}
+
+void PLH::MemRegionMap::invalidate()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stale = true;
+}
+
+#if defined(POLYHOOK2_OS_WINDOWS)
+
+void PLH::MemRegionMap::refresh()
+{
+    m_regions.clear();
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+
+    MEMORY_BASIC_INFORMATION mbi;
+    for (uint64_t addr = (uint64_t)si.lpMinimumApplicationAddress; addr < (uint64_t)si.lpMaximumApplicationAddress;)
+    {
+        if (!VirtualQuery((char*)addr, &mbi, sizeof(mbi)) || mbi.RegionSize == 0)
+            break;
+
+        const uint64_t start = (uint64_t)mbi.BaseAddress;
+        const uint64_t end = start + mbi.RegionSize;
+        if (mbi.State == MEM_COMMIT && !(mbi.Protect & PAGE_GUARD))
+        {
+            // strip modifiers such as PAGE_NOCACHE, TranslateProtection only knows the base values
+            m_regions.push_back({start, end, TranslateProtection(static_cast<int>(mbi.Protect & 0xFF))});
+        }
+        addr = end;
+    }
+    m_stale = false;
+}
+
+bool PLH::MemRegionMap::isMapped(uint64_t addr)
+{
+    MEMORY_BASIC_INFORMATION mbi;
+    return VirtualQuery((char*)addr, &mbi, sizeof(mbi)) != 0 && mbi.State == MEM_COMMIT;
+}
+
+#elif defined(POLYHOOK2_OS_LINUX)
+
+void PLH::MemRegionMap::refresh()
+{
+	m_regions.clear();
+
+	std::ifstream f("/proc/self/maps");
+	std::string s;
+	while (std::getline(f, s)) {
+		if (s.empty())
+			continue;
+
+		char* strend = &s[0];
+		const uint64_t start = strtoull(strend, &strend, 16);
+		const uint64_t end = strtoull(strend + 1, &strend, 16);
+		if (start == 0 || end == 0)
+			continue;
+
+		PLH::ProtFlag prot = PLH::ProtFlag::UNSET;
+		++strend;
+		if (strend[0] == 'r')
+			prot = prot | PLH::ProtFlag::R;
+
+		if (strend[1] == 'w')
+			prot = prot | PLH::ProtFlag::W;
+
+		if (strend[2] == 'x')
+			prot = prot | PLH::ProtFlag::X;
+
+		if (prot == PLH::ProtFlag::UNSET)
+			prot = PLH::ProtFlag::NONE;
+
+		// kept so isMapped and the map agree on them, otherwise every lookup there re-reads the file
+		const bool kernel = s.find("[vdso]") != std::string::npos || s.find("[vvar]") != std::string::npos ||
+			s.find("[vsyscall]") != std::string::npos;
+
+		// the kernel lists mappings in ascending order, keep it that way for the binary search
+		m_regions.push_back({start, end, prot, kernel});
+	}
+	m_stale = false;
+}
+
+bool PLH::MemRegionMap::isMapped(uint64_t addr)
+{
+	// mincore fails with ENOMEM for unmapped pages, a single syscall and no parsing
+	const uint64_t page = MEMORY_ROUND(addr, static_cast<uint64_t>(sysconf(_SC_PAGESIZE)));
+	unsigned char vec = 0;
+	return mincore((void*)page, 1, &vec) == 0 || errno != ENOMEM;
+}
+
+#elif defined(POLYHOOK2_OS_APPLE)
+
+void PLH::MemRegionMap::refresh()
+{
+	m_regions.clear();
+
+	mach_vm_address_t addr = 0;
+	mach_vm_size_t size = 0;
+	vm_region_basic_info_data_64_t info;
+	for (;;) {
+		mach_msg_type_number_t count = VM_REGION_BASIC_INFO_COUNT_64;
+		mach_port_t object = MACH_PORT_NULL;
+		if (mach_vm_region(mach_task_self(), &addr, &size, VM_REGION_BASIC_INFO_64, (vm_region_info_t)&info, &count,
+		                   &object) != KERN_SUCCESS)
+			break;
+
+		m_regions.push_back({addr, addr + size, TranslateProtection(info.protection)});
+		addr += size;
+	}
+	m_stale = false;
+}
+
+bool PLH::MemRegionMap::isMapped(uint64_t addr)
+{
+	mach_vm_address_t regionAddr = addr;
+	mach_vm_size_t size = 0;
+	vm_region_basic_info_data_64_t info;
+	mach_msg_type_number_t count = VM_REGION_BASIC_INFO_COUNT_64;
+	mach_port_t object = MACH_PORT_NULL;
+	if (mach_vm_region(mach_task_self(), &regionAddr, &size, VM_REGION_BASIC_INFO_64, (vm_region_info_t)&info, &count,
+	                   &object) != KERN_SUCCESS)
+		return false;
+
+	// mach_vm_region returns the next region at or above addr
+	return regionAddr <= addr;
+}
+
+#endif
@@ -0,0 +1,205 @@
+#include "polyhook2/MemScanner.hpp"
+#include "polyhook2/MemRegionMap.hpp"
+
+#include <thread>
+
+PLH::MemScanner::MemScanner(const MemAccessor& accessor) : m_accessor(accessor)
+{
+}
+
+std::vector<PLH::MemScanner::Chunk> PLH::MemScanner::makeChunks(const uint64_t start, const uint64_t end,
+                                                                const size_t overlap, const ScanOptions& options) const
+{
+    // merge adjacent scanned regions so a match may cross a protection boundary
+    const ProtFlag required = options.requiredProt | ProtFlag::R;
+    std::vector<std::pair<uint64_t, uint64_t>> spans;
+    for (const auto& region : MemRegionMap::singleton().regions(start, end))
+    {
+        if ((region.prot | required) != region.prot)
+            continue;
+
+        const uint64_t s = std::max(region.start, start);
+        const uint64_t e = std::min(region.end, end);
+        if (!spans.empty() && spans.back().second == s)
+            spans.back().second = e;
+        else
+            spans.emplace_back(s, e);
+    }
+
+    const uint64_t chunkSize = std::max<uint64_t>(options.chunkSize, 0x1000);
+    std::vector<Chunk> chunks;
+    for (const auto& [s, e] : spans)
+    {
+        for (uint64_t c = s; c < e; c += chunkSize)
+        {
+            const uint64_t ce = std::min(c + chunkSize, e);
+            const uint64_t readEnd = std::min(ce + overlap, e);
+
+            uint64_t distance = 0;
+            if (options.target < c)
+                distance = c - options.target;
+            else if (options.target >= ce)
+                distance = options.target - (ce - 1);
+            chunks.push_back({c, ce, readEnd, distance});
+        }
+    }
+
+    // nearest first, so the search can stop as soon as the next chunk is further than the best match
+    if (options.mode == ScanMode::NEAREST)
+    {
+        std::stable_sort(chunks.begin(), chunks.end(), [](const Chunk& a, const Chunk& b)
+        {
+            return a.distance < b.distance;
+        });
+    }
+    return chunks;
+}
+
+std::vector<PLH::MultiPattern::Match> PLH::MemScanner::scan(const MultiPattern& patterns, const uint64_t start,
+                                                            const uint64_t end, const ScanOptions& options) const
+{
+    size_t longest = 0;
+    for (size_t i = 0; i < patterns.size(); i++)
+    {
+        longest = std::max(longest, patterns[i].size());
+    }
+
+    if (longest == 0 || start >= end)
+        return {};
+
+    const std::vector<Chunk> chunks = makeChunks(start, end, longest - 1, options);
+    if (chunks.empty())
+        return {};
+
+    const auto distanceTo = [&](const uint64_t address)
+    {
+        return address > options.target ? address - options.target : options.target - address;
+    };
+
+    std::vector<std::vector<MultiPattern::Match>> perChunk(chunks.size());
+    std::atomic<size_t> next = 0;
+
+    // FIRST: lowest chunk index with a match. NEAREST: smallest distance of any match so far
+    std::atomic<size_t> firstChunk = std::numeric_limits<size_t>::max();
+    std::atomic<uint64_t> nearest = std::numeric_limits<uint64_t>::max();
+
+    const auto worker = [&]()
+    {
+        std::vector<uint8_t> buf;
+        for (size_t i = next++; i < chunks.size(); i = next++)
+        {
+            const Chunk& chunk = chunks[i];
+            if (options.mode == ScanMode::FIRST && i > firstChunk.load(std::memory_order_relaxed))
+                continue;
+            if (options.mode == ScanMode::NEAREST && chunk.distance > nearest.load(std::memory_order_relaxed))
+                return; // chunks are sorted by distance, all the rest are further too
+
+            buf.resize(static_cast<size_t>(chunk.readEnd - chunk.start));
+
+            // a span can cover several regions and a read may stop at the end of each one
+            size_t read = 0;
+            while (read < buf.size())
+            {
+                size_t got = 0;
+                if (!m_accessor.safe_mem_read(chunk.start + read, (uint64_t)buf.data() + read, buf.size() - read, got) ||
+                    got == 0)
+                    break;
+                read += got;
+            }
+            if (read == 0)
+                continue;
+
+            std::vector<MultiPattern::Match> found;
+            for (const auto& match : patterns.findAll((uint64_t)buf.data(), read))
+            {
+                const uint64_t address = chunk.start + (match.address - (uint64_t)buf.data());
+                if (address >= chunk.end)
+                    break; // inside the overlap, belongs to the next chunk
+                found.push_back({address, match.index});
+            }
+
+            if (found.empty())
+                continue;
+
+            if (options.mode == ScanMode::FIRST)
+            {
+                found.resize(1);
+                size_t cur = firstChunk.load();
+                while (i < cur && !firstChunk.compare_exchange_weak(cur, i));
+            }
+            else if (options.mode == ScanMode::NEAREST)
+            {
+                const auto best = std::min_element(found.begin(), found.end(), [&](const auto& a, const auto& b)
+                {
+                    return distanceTo(a.address) < distanceTo(b.address);
+                });
+                found = {*best};
+
+                const uint64_t dist = distanceTo(best->address);
+                uint64_t cur = nearest.load();
+                while (dist < cur && !nearest.compare_exchange_weak(cur, dist));
+            }
+            perChunk[i] = std::move(found);
+        }
+    };
+
+    uint32_t threadCount = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    threadCount = static_cast<uint32_t>(std::min<size_t>(threadCount, chunks.size()));
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 1; t < threadCount; t++)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    std::vector<MultiPattern::Match> results;
+    for (auto& found : perChunk)
+    {
+        results.insert(results.end(), found.begin(), found.end());
+    }
+
+    // chunks of ALL are in address order and don't share matches, so this is already sorted
+    if (options.mode == ScanMode::ALL || results.empty())
+        return results;
+
+    // reduce to the single winner, ties go to the lower address
+    const auto best = std::min_element(results.begin(), results.end(), [&](const auto& a, const auto& b)
+    {
+        if (options.mode == ScanMode::FIRST)
+            return a.address < b.address;
+
+        const uint64_t da = distanceTo(a.address);
+        const uint64_t db = distanceTo(b.address);
+        return da < db || (da == db && a.address < b.address);
+    });
+    return {*best};
+}
+
+std::vector<uint64_t> PLH::MemScanner::scan(const Pattern& pattern, const uint64_t start, const uint64_t end,
+                                            const ScanOptions& options) const
+{
+    std::vector<uint64_t> addresses;
+    for (const auto& match : scan(MultiPattern({pattern}), start, end, options))
+    {
+        addresses.push_back(match.address);
+    }
+    return addresses;
+}
+
+std::optional<uint64_t> PLH::MemScanner::findNearest(const Pattern& pattern, const uint64_t target) const
+{
+    ScanOptions options;
+    options.mode = ScanMode::NEAREST;
+    options.target = target;
+    options.requiredProt = ProtFlag::R | ProtFlag::X;
+
+    const auto found = scan(pattern, calc_2gb_below(target), calc_2gb_above(target), options);
+    if (found.empty())
+        return {};
+    return found.front();
+}
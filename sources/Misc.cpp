@@ -1,44 +1,386 @@
 #include "polyhook2/MemAccessor.hpp"
+#include "polyhook2/MemRegionMap.hpp"
 #include "polyhook2/Misc.hpp"
 #include "polyhook2/PolyHookOsIncludes.hpp"
 
-uint64_t PLH::findPattern(const uint64_t rangeStart, size_t len, const char* pattern)
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PLH_PATTERN_SIMD
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PLH_TARGET(x)
+#else
+#define PLH_TARGET(x) __attribute__((target(x)))
+#endif
+#endif
+
+namespace
 {
-    unsigned char pattern_scratch[FINDPATTERN_SCRATCH_SIZE] = {0};
-    unsigned char mask_scratch[FINDPATTERN_SCRATCH_SIZE] = {0};
-    const size_t patSize = static_cast<size_t>(getPatternSize(pattern));
-    auto pat = (char*)&pattern_scratch[0];
-    auto msk = (char*)&mask_scratch[0];
+    struct PatternScan
+    {
+        const uint8_t* base;
+        size_t candidates; // number of valid start offsets
+        const uint8_t* bytes;
+        const uint8_t* mask;
+        size_t size;
+        size_t anchor1;
+        size_t anchor2;
+
+        bool verify(const size_t n) const
+        {
+            const uint8_t* addr = base + n;
+            for (size_t i = 0; i < size; i++)
+            {
+                if (mask[i] && addr[i] != bytes[i])
+                    return false;
+            }
+            return true;
+        }
+    };
+
+    constexpr size_t NO_MATCH = std::numeric_limits<size_t>::max();
+
+    // rough ranking of how often a byte shows up in x86 code, 0 = not common
+    uint8_t byteCommonness(const uint8_t b)
+    {
+        switch (b)
+        {
+        case 0x00: return 10;
+        case 0xFF:
+        case 0xCC: return 9;
+        case 0x48:
+        case 0x8B: return 8;
+        case 0x89:
+        case 0x0F:
+        case 0x90: return 7;
+        case 0x4C:
+        case 0x24:
+        case 0x44:
+        case 0xE8: return 6;
+        case 0x83:
+        case 0x85:
+        case 0x74:
+        case 0x75:
+        case 0xC3:
+        case 0x66: return 5;
+        case 0x01:
+        case 0x08:
+        case 0x10:
+        case 0x20:
+        case 0x40:
+        case 0x80: return 4;
+        default: return 0;
+        }
+    }
 
-    if (patSize + 1 > len)
-        return NULL;
+    size_t scanScalar(const PatternScan& s)
+    {
+        const uint8_t b1 = s.bytes[s.anchor1];
+        for (size_t n = 0; n < s.candidates;)
+        {
+            const auto hit = (const uint8_t*)memchr(s.base + s.anchor1 + n, b1, s.candidates - n);
+            if (hit == nullptr)
+                break;
+
+            n = static_cast<size_t>(hit - (s.base + s.anchor1));
+            if (s.verify(n))
+                return n;
+            n++;
+        }
+        return NO_MATCH;
+    }
 
-    size_t counter = patSize;
-    while (counter)
+    size_t scanScalarRev(const PatternScan& s, size_t end)
+    {
+        const uint8_t b1 = s.bytes[s.anchor1];
+        const uint8_t b2 = s.bytes[s.anchor2];
+        while (end-- > 0)
+        {
+            if (s.base[end + s.anchor1] == b1 && s.base[end + s.anchor2] == b2 && s.verify(end))
+                return end;
+        }
+        return NO_MATCH;
+    }
+
+#ifdef PLH_PATTERN_SIMD
+    inline uint32_t lowestBit(const uint32_t v)
+    {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanForward(&idx, v);
+        return idx;
+#else
+        return static_cast<uint32_t>(__builtin_ctz(v));
+#endif
+    }
+
+    inline uint32_t highestBit(const uint32_t v)
+    {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanReverse(&idx, v);
+        return idx;
+#else
+        return 31 - static_cast<uint32_t>(__builtin_clz(v));
+#endif
+    }
+
+    // bit i set when both anchors match for the candidate at n + i, the broadcasts get hoisted once inlined
+    PLH_TARGET("sse2") inline uint32_t candidatesAt16(const PatternScan& s, const size_t n)
+    {
+        const __m128i v1 = _mm_set1_epi8(static_cast<char>(s.bytes[s.anchor1]));
+        const __m128i v2 = _mm_set1_epi8(static_cast<char>(s.bytes[s.anchor2]));
+        const __m128i d1 = _mm_loadu_si128((const __m128i*)(s.base + n + s.anchor1));
+        const __m128i d2 = _mm_loadu_si128((const __m128i*)(s.base + n + s.anchor2));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(d1, v1), _mm_cmpeq_epi8(d2, v2))));
+    }
+
+    PLH_TARGET("avx2") inline uint32_t candidatesAt32(const PatternScan& s, const size_t n)
+    {
+        const __m256i v1 = _mm256_set1_epi8(static_cast<char>(s.bytes[s.anchor1]));
+        const __m256i v2 = _mm256_set1_epi8(static_cast<char>(s.bytes[s.anchor2]));
+        const __m256i d1 = _mm256_loadu_si256((const __m256i*)(s.base + n + s.anchor1));
+        const __m256i d2 = _mm256_loadu_si256((const __m256i*)(s.base + n + s.anchor2));
+        return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(d1, v1),
+                                                                           _mm256_cmpeq_epi8(d2, v2))));
+    }
+
+    PLH_TARGET("sse2") size_t scanSse2(const PatternScan& s, const bool reverse)
+    {
+
+        if (!reverse)
+        {
+            size_t n = 0;
+            for (; n + 16 <= s.candidates; n += 16)
+            {
+                for (uint32_t bits = candidatesAt16(s, n); bits; bits &= bits - 1)
+                {
+                    const size_t idx = n + lowestBit(bits);
+                    if (s.verify(idx))
+                        return idx;
+                }
+            }
+
+            PatternScan tail = s;
+            tail.base += n;
+            tail.candidates -= n;
+            const size_t found = scanScalar(tail);
+            return found == NO_MATCH ? NO_MATCH : found + n;
+        }
+
+        size_t n = s.candidates;
+        for (; n >= 16; n -= 16)
+        {
+            for (uint32_t bits = candidatesAt16(s, n - 16); bits; bits &= ~(1u << highestBit(bits)))
+            {
+                const size_t idx = n - 16 + highestBit(bits);
+                if (s.verify(idx))
+                    return idx;
+            }
+        }
+        return scanScalarRev(s, n);
+    }
+
+    PLH_TARGET("avx2") size_t scanAvx2(const PatternScan& s, const bool reverse)
+    {
+        if (!reverse)
+        {
+            size_t n = 0;
+            for (; n + 32 <= s.candidates; n += 32)
+            {
+                for (uint32_t bits = candidatesAt32(s, n); bits; bits &= bits - 1)
+                {
+                    const size_t idx = n + lowestBit(bits);
+                    if (s.verify(idx))
+                        return idx;
+                }
+            }
+
+            // finish the last partial block with sse2 and then scalar
+            PatternScan tail = s;
+            tail.base += n;
+            tail.candidates -= n;
+            const size_t found = scanSse2(tail, false);
+            return found == NO_MATCH ? NO_MATCH : found + n;
+        }
+
+        size_t n = s.candidates;
+        for (; n >= 32; n -= 32)
+        {
+            for (uint32_t bits = candidatesAt32(s, n - 32); bits; bits &= ~(1u << highestBit(bits)))
+            {
+                const size_t idx = n - 32 + highestBit(bits);
+                if (s.verify(idx))
+                    return idx;
+            }
+        }
+
+        PatternScan head = s;
+        head.candidates = n;
+        return scanSse2(head, true);
+    }
+
+    bool cpuHasAvx2()
+    {
+#if defined(_MSC_VER)
+        int regs[4];
+        __cpuid(regs, 0);
+        if (regs[0] < 7)
+            return false;
+
+        // avx needs os support for the ymm state as well
+        __cpuid(regs, 1);
+        const bool osxsave = (regs[2] & (1 << 27)) != 0;
+        const bool avx = (regs[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+            return false;
+
+        __cpuidex(regs, 7, 0);
+        return (regs[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+
+    bool cpuHasSse2()
+    {
+#if defined(__x86_64__) || defined(_M_X64)
+        return true;
+#elif defined(_MSC_VER)
+        int regs[4];
+        __cpuid(regs, 1);
+        return (regs[3] & (1 << 26)) != 0;
+#else
+        return __builtin_cpu_supports("sse2");
+#endif
+    }
+#endif
+
+    enum class ScanLevel
+    {
+        Scalar,
+        SSE2,
+        AVX2
+    };
+
+    ScanLevel scanLevel()
+    {
+        static const ScanLevel level = []()
+        {
+#ifdef PLH_PATTERN_SIMD
+            if (cpuHasAvx2())
+                return ScanLevel::AVX2;
+            if (cpuHasSse2())
+                return ScanLevel::SSE2;
+#endif
+            return ScanLevel::Scalar;
+        }();
+        return level;
+    }
+
+    size_t dispatchScan(const PatternScan& s, const bool reverse)
+    {
+        switch (scanLevel())
+        {
+#ifdef PLH_PATTERN_SIMD
+        case ScanLevel::AVX2: return scanAvx2(s, reverse);
+        case ScanLevel::SSE2: return scanSse2(s, reverse);
+#endif
+        default: return reverse ? scanScalarRev(s, s.candidates) : scanScalar(s);
+        }
+    }
+}
+
+PLH::Pattern::Pattern(const char* pattern)
+{
+    const size_t patSize = static_cast<size_t>(getPatternSize(pattern));
+    m_bytes.reserve(patSize);
+    m_mask.reserve(patSize);
+
+    for (size_t i = 0; i < patSize; i++, pattern += 3)
     {
         if (*(uint8_t*)pattern == static_cast<uint8_t>('\?'))
         {
-            *pat++ = 0;
-            *msk++ = '?';
+            m_bytes.push_back(0);
+            m_mask.push_back(0);
         }
         else
         {
-            *pat++ = getByte(pattern);
-            *msk++ = 'x';
+            m_bytes.push_back(static_cast<uint8_t>(getByte(pattern)));
+            m_mask.push_back(1);
         }
-        pattern += 3;
-        counter--;
     }
 
-    *msk = 0;
-    for (size_t n = 0; n < (len - (patSize + 1)); ++n)
+    // pick the two least common fixed bytes, the earliest one wins a tie
+    size_t best = NO_MATCH;
+    size_t second = NO_MATCH;
+    for (size_t i = 0; i < m_bytes.size(); i++)
     {
-        if (isMatch((char*)(rangeStart + n), (char*)(&pattern_scratch[0]), (char*)(&mask_scratch[0])))
+        if (!m_mask[i])
+            continue;
+
+        if (best == NO_MATCH || byteCommonness(m_bytes[i]) < byteCommonness(m_bytes[best]))
+        {
+            second = best;
+            best = i;
+        }
+        else if (second == NO_MATCH || byteCommonness(m_bytes[i]) < byteCommonness(m_bytes[second]))
         {
-            return rangeStart + n;
+            second = i;
         }
     }
-    return NULL;
+
+    m_hasFixed = best != NO_MATCH;
+    if (m_hasFixed)
+    {
+        m_anchor1 = best;
+        m_anchor2 = second == NO_MATCH ? best : second;
+    }
+}
+
+bool PLH::Pattern::matches(const uint8_t* addr) const
+{
+    for (size_t i = 0; i < m_bytes.size(); i++)
+    {
+        if (m_mask[i] && addr[i] != m_bytes[i])
+            return false;
+    }
+    return true;
+}
+
+uint64_t PLH::Pattern::find(const uint64_t rangeStart, const size_t len) const
+{
+    if (m_bytes.empty() || m_bytes.size() > len)
+        return 0;
+
+    const size_t candidates = len - m_bytes.size() + 1;
+    if (!m_hasFixed)
+        return rangeStart;
+
+    const PatternScan scan{(const uint8_t*)rangeStart, candidates, m_bytes.data(), m_mask.data(), m_bytes.size(),
+                           m_anchor1, m_anchor2};
+    const size_t found = dispatchScan(scan, false);
+    return found == NO_MATCH ? 0 : rangeStart + found;
+}
+
+uint64_t PLH::Pattern::find_rev(const uint64_t rangeStart, const size_t len) const
+{
+    if (m_bytes.empty() || m_bytes.size() > len)
+        return 0;
+
+    const size_t candidates = len - m_bytes.size() + 1;
+    if (!m_hasFixed)
+        return rangeStart + candidates - 1;
+
+    const PatternScan scan{(const uint8_t*)rangeStart, candidates, m_bytes.data(), m_mask.data(), m_bytes.size(),
+                           m_anchor1, m_anchor2};
+    const size_t found = dispatchScan(scan, true);
+    return found == NO_MATCH ? 0 : rangeStart + found;
+}
+
+uint64_t PLH::findPattern(const uint64_t rangeStart, size_t len, const char* pattern)
+{
+    return Pattern(pattern).find(rangeStart, len);
 }
 
 uint64_t PLH::getPatternSize(const char* pattern)
@@ -51,41 +393,128 @@ uint64_t PLH::getPatternSize(const char* pattern)
 
 uint64_t PLH::findPattern_rev(const uint64_t rangeStart, size_t len, const char* pattern)
 {
-    unsigned char pattern_scratch[FINDPATTERN_SCRATCH_SIZE] = {0};
-    unsigned char mask_scratch[FINDPATTERN_SCRATCH_SIZE] = {0};
-    const size_t patSize = static_cast<size_t>(getPatternSize(pattern));
-    auto pat = (char*)&pattern_scratch[0];
-    auto msk = (char*)&mask_scratch[0];
+    return Pattern(pattern).find_rev(rangeStart, len);
+}
 
-    if (patSize + 1 > len)
-        return NULL;
+PLH::MultiPattern::MultiPattern(std::vector<Pattern> patterns) : m_patterns(std::move(patterns))
+{
+    // counting sort of the pattern indices by first byte, keeps each bucket in priority order
+    uint32_t counts[256] = {};
+    for (const auto& pat : m_patterns)
+    {
+        if (!pat.m_bytes.empty() && pat.m_mask[0])
+            counts[pat.m_bytes[0]]++;
+    }
 
-    size_t counter = patSize;
-    while (counter)
+    for (size_t b = 0; b < 256; b++)
     {
-        if (*(uint8_t*)pattern == static_cast<uint8_t>('\?'))
-        {
-            *pat++ = 0;
-            *msk++ = '?';
-        }
+        m_bucketStart[b + 1] = m_bucketStart[b] + counts[b];
+    }
+
+    m_buckets.resize(m_bucketStart[256]);
+    uint32_t fill[256];
+    std::copy(m_bucketStart, m_bucketStart + 256, fill);
+    for (uint32_t i = 0; i < m_patterns.size(); i++)
+    {
+        const auto& pat = m_patterns[i];
+        if (pat.m_bytes.empty())
+            continue;
+
+        if (pat.m_mask[0])
+            m_buckets[fill[pat.m_bytes[0]]++] = i;
+        else
+            m_wildcardFirst.push_back(i);
+    }
+}
+
+template <typename F>
+void PLH::MultiPattern::forCandidates(const uint8_t* p, const size_t remaining, F&& f) const
+{
+    const uint32_t* bucket = m_buckets.data() + m_bucketStart[*p];
+    const uint32_t* bucketEnd = m_buckets.data() + m_bucketStart[*p + 1];
+    const uint32_t* wild = m_wildcardFirst.data();
+    const uint32_t* wildEnd = wild + m_wildcardFirst.size();
+
+    // merge both lists so candidates come out in priority order
+    while (bucket != bucketEnd || wild != wildEnd)
+    {
+        uint32_t idx;
+        if (wild == wildEnd || (bucket != bucketEnd && *bucket < *wild))
+            idx = *bucket++;
         else
+            idx = *wild++;
+
+        const Pattern& pat = m_patterns[idx];
+        if (pat.size() > remaining || !pat.matches(p))
+            continue;
+
+        if (!f(idx))
+            return;
+    }
+}
+
+std::vector<PLH::MultiPattern::Match> PLH::MultiPattern::findAll(const uint64_t rangeStart, const size_t len) const
+{
+    std::vector<Match> matches;
+    const auto* base = (const uint8_t*)rangeStart;
+    for (size_t n = 0; n < len; n++)
+    {
+        forCandidates(base + n, len - n, [&](const size_t idx)
         {
-            *pat++ = getByte(pattern);
-            *msk++ = 'x';
-        }
-        pattern += 3;
-        counter--;
+            matches.push_back({rangeStart + n, idx});
+            return true;
+        });
     }
+    return matches;
+}
 
-    *msk = 0;
-    for (size_t n = len - (patSize + 1); n > 0; n--)
+std::optional<PLH::MultiPattern::Match> PLH::MultiPattern::findBest(const uint64_t rangeStart, const size_t len) const
+{
+    // the first hit of a pattern is its earliest occurrence, so a later hit only wins with a higher priority
+    std::optional<Match> best;
+    const auto* base = (const uint8_t*)rangeStart;
+    for (size_t n = 0; n < len && !(best && best->index == 0); n++)
     {
-        if (isMatch((char*)(rangeStart + n), (char*)(&pattern_scratch[0]), (char*)(&mask_scratch[0])))
+        forCandidates(base + n, len - n, [&](const size_t idx)
         {
-            return rangeStart + n;
-        }
+            if (best && idx >= best->index)
+                return false;
+
+            best = Match{rangeStart + n, idx};
+            return false;
+        });
+    }
+    return best;
+}
+
+std::optional<PLH::MultiPattern::Match> PLH::MultiPattern::findBest_rev(const uint64_t rangeStart, const size_t len) const
+{
+    std::optional<Match> best;
+    const auto* base = (const uint8_t*)rangeStart;
+    for (size_t n = len; n > 0 && !(best && best->index == 0); n--)
+    {
+        forCandidates(base + n - 1, len - n + 1, [&](const size_t idx)
+        {
+            if (best && idx >= best->index)
+                return false;
+
+            best = Match{rangeStart + n - 1, idx};
+            return false;
+        });
+    }
+    return best;
+}
+
+std::vector<PLH::MultiPattern::Match> PLH::findPatterns(const uint64_t rangeStart, const size_t len,
+                                                       const std::vector<const char*>& patterns)
+{
+    std::vector<Pattern> compiled;
+    compiled.reserve(patterns.size());
+    for (const char* pattern : patterns)
+    {
+        compiled.emplace_back(pattern);
     }
-    return NULL;
+    return MultiPattern(std::move(compiled)).findAll(rangeStart, len);
 }
 
 uint64_t PLH::calc_2gb_below(uint64_t address)
@@ -195,6 +624,7 @@ void PLH::boundAllocFree(uint64_t address, uint64_t size)
 {
     (void)size;
     VirtualFree((LPVOID)address, 0, MEM_RELEASE);
+    MemRegionMap::singleton().invalidate();
 }
 
 size_t PLH::getAllocationAlignment()
@@ -224,26 +654,87 @@ uint64_t PLH::boundAlloc(uint64_t min, uint64_t max, uint64_t size)
 	return boundAllocLegacy(min, max, size);
 }
 
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000 // linux 4.17, older kernels treat the request as a plain hint
+#endif
+
 uint64_t PLH::boundAllocLegacy(uint64_t start, uint64_t end, uint64_t size)
 {
-	void* hint = (void*)((end - 1) / 2 + start / 2);
-	uint64_t res = (uint64_t)mmap(hint, (size_t)size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-
-	if (res == (uint64_t)MAP_FAILED)
+	const uint64_t alignment = getAllocationAlignment();
+	size = AlignUpwards(size, static_cast<size_t>(alignment));
+	if (start >= end || end - start < size)
 		return 0;
 
-	if (res < start || res >= end)
+	// callers center the range on the address they want to be near
+	const uint64_t hint = (end - 1) / 2 + start / 2;
+
+	// the snapshot can miss mappings made since it was taken, a collision refreshes it and tries once more
+	for (int attempt = 0; attempt < 2; attempt++)
 	{
-		boundAllocFree(res, size);
-		return 0;
+		// candidate address in every unmapped hole of [start, end), as close to the hint as the hole allows
+		std::vector<uint64_t> candidates;
+		uint64_t gapStart = start;
+		const auto addCandidate = [&](const uint64_t gapEnd)
+		{
+			const uint64_t lo = AlignUpwards(std::max(gapStart, alignment), static_cast<size_t>(alignment));
+			if (gapEnd <= lo || gapEnd - lo < size)
+				return;
+
+			const uint64_t hi = AlignDownwards(gapEnd - size, static_cast<size_t>(alignment));
+			const uint64_t nearHint = AlignDownwards(std::max(hint, alignment), static_cast<size_t>(alignment));
+			candidates.push_back(std::clamp(nearHint, lo, hi));
+		};
+
+		for (const auto& region : MemRegionMap::singleton().regions(start, end))
+		{
+			if (region.start > gapStart)
+				addCandidate(std::min(region.start, end));
+			gapStart = std::max(gapStart, region.end);
+		}
+		if (gapStart < end)
+			addCandidate(end);
+
+		std::sort(candidates.begin(), candidates.end(), [&](const uint64_t a, const uint64_t b)
+		{
+			const uint64_t da = a > hint ? a - hint : hint - a;
+			const uint64_t db = b > hint ? b - hint : hint - b;
+			return da < db;
+		});
+
+		bool collided = false;
+		for (const uint64_t candidate : candidates)
+		{
+			const uint64_t res = (uint64_t)mmap((void*)candidate, (size_t)size, PROT_READ | PROT_WRITE | PROT_EXEC,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+			if (res == (uint64_t)MAP_FAILED)
+			{
+				collided |= errno == EEXIST;
+				continue;
+			}
+
+			if (res != candidate)
+			{
+				// kernel without MAP_FIXED_NOREPLACE placed it elsewhere
+				munmap((void*)res, (size_t)size);
+				continue;
+			}
+
+			MemRegionMap::singleton().invalidate();
+			return res;
+		}
+
+		if (!collided)
+			break;
+		MemRegionMap::singleton().invalidate();
 	}
 
-	return res;
+	return 0;
 }
 
 void PLH::boundAllocFree(uint64_t address, uint64_t size)
 {
 	munmap((void*)address, (size_t)size);
+	MemRegionMap::singleton().invalidate();
 }
 
 size_t PLH::getAllocationAlignment()
@@ -307,6 +798,7 @@ uint64_t PLH::boundAllocLegacy(uint64_t start, uint64_t end, uint64_t size)
 void PLH::boundAllocFree(uint64_t address, uint64_t size)
 {
 	mach_vm_deallocate(mach_task_self(), (mach_vm_address_t)address, size);
+	MemRegionMap::singleton().invalidate();
 }
 
 size_t PLH::getAllocationAlignment()
@@ -0,0 +1,188 @@
+#include "polyhook2/NearCodeHeap.hpp"
+#include "polyhook2/ErrorLog.hpp"
+#include "polyhook2/PolyHookOsIncludes.hpp"
+
+namespace PLH
+{
+    NearCodeHeap& NearCodeHeap::singleton()
+    {
+        static NearCodeHeap heap;
+        return heap;
+    }
+
+    NearCodeHeap::NearCodeHeap()
+        : m_small(SMALL_BLOCK_SIZE, static_cast<uint32_t>(CHUNK_SIZE / SMALL_BLOCK_SIZE))
+    {
+    }
+
+    uint64_t NearCodeHeap::allocate(const uint64_t target, const uint64_t size)
+    {
+        return allocate(target, size, calc_2gb_below(target), calc_2gb_above(target));
+    }
+
+    uint64_t NearCodeHeap::allocate(uint64_t target, uint64_t size, const uint64_t min, const uint64_t max)
+    {
+        if (size == 0 || min >= max)
+            return 0;
+        size = AlignUpwards(size, BLOCK_ALIGN);
+        target = std::clamp(target, min, max - 1);
+
+        if (size <= SMALL_BLOCK_SIZE)
+        {
+            const auto block = (uint64_t)m_small.allocate(min, max, target);
+            if (block && block >= min && block + size <= max)
+                return block;
+
+            // the same WINE workaround as reserveChunk, VirtualAlloc2 doesn't always honour the range
+            if (block)
+                m_small.deallocate(block);
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // walk outwards from target, always stepping to whichever side is closer
+        auto hi = m_chunks.lower_bound(target);
+        auto lo = hi;
+        while (true)
+        {
+            const bool hiValid = hi != m_chunks.end() && hi->first < max;
+            const bool loValid = lo != m_chunks.begin() && std::prev(lo)->second.end > min;
+            if (!hiValid && !loValid)
+                break;
+
+            bool takeHi = hiValid;
+            if (hiValid && loValid)
+            {
+                const uint64_t loEnd = std::prev(lo)->second.end;
+                const uint64_t loDistance = loEnd > target ? 0 : target - loEnd;
+                takeHi = hi->first - target <= loDistance;
+            }
+
+            const auto it = takeHi ? hi++ : --lo;
+            if (const uint64_t block = takeFrom(it->second, size, min, max))
+            {
+                m_used.emplace(block, size);
+                return block;
+            }
+        }
+
+        const uint64_t chunk = reserveChunk(target, size, min, max);
+        if (!chunk)
+        {
+            PLH_LOG("Near code heap failed to reserve memory near " + int_to_hex(target), ErrorLevel::SEV);
+            return 0;
+        }
+
+        const uint64_t block = takeFrom(m_chunks[chunk], size, min, max);
+        assert(block != 0);
+        m_used.emplace(block, size);
+        return block;
+    }
+
+    void NearCodeHeap::deallocate(const uint64_t address)
+    {
+        if (m_small.owns(address))
+        {
+            m_small.deallocate(address);
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        const auto used = m_used.find(address);
+        if (used == m_used.end())
+        {
+            assert(false);
+            return;
+        }
+
+        uint64_t start = used->first;
+        uint64_t length = used->second;
+        m_used.erase(used);
+
+        // owning chunk is the last one starting at or below address
+        auto chunk = m_chunks.upper_bound(address);
+        assert(chunk != m_chunks.begin());
+        auto& free = std::prev(chunk)->second.free;
+
+        // merge with the free runs on either side
+        auto next = free.lower_bound(start);
+        if (next != free.end() && start + length == next->first)
+        {
+            length += next->second;
+            next = free.erase(next);
+        }
+        if (next != free.begin())
+        {
+            const auto prev = std::prev(next);
+            if (prev->first + prev->second == start)
+            {
+                start = prev->first;
+                length += prev->second;
+                free.erase(prev);
+            }
+        }
+        free.emplace(start, length);
+    }
+
+    uint64_t NearCodeHeap::takeFrom(Chunk& chunk, const uint64_t size, const uint64_t min, const uint64_t max)
+    {
+        for (auto it = chunk.free.begin(); it != chunk.free.end(); ++it)
+        {
+            const uint64_t runStart = it->first;
+            const uint64_t runEnd = it->first + it->second;
+            const uint64_t block = std::max(runStart, min ? AlignUpwards(min, BLOCK_ALIGN) : 0);
+            if (block >= runEnd || runEnd - block < size || block + size > max)
+                continue;
+
+            chunk.free.erase(it);
+            if (block > runStart)
+                chunk.free.emplace(runStart, block - runStart);
+            if (block + size < runEnd)
+                chunk.free.emplace(block + size, runEnd - (block + size));
+            return block;
+        }
+        return 0;
+    }
+
+    uint64_t NearCodeHeap::reserveChunk(const uint64_t target, const uint64_t size, const uint64_t min,
+                                        const uint64_t max)
+    {
+        const uint64_t chunkSize = AlignUpwards(size, CHUNK_SIZE);
+        const uint64_t alignment = getAllocationAlignment();
+
+        // try a tight window first so the new chunk lands close, then the whole range
+        constexpr uint64_t windows[] = {0x10000000, std::numeric_limits<uint64_t>::max()};
+        for (const uint64_t window : windows)
+        {
+            const uint64_t lo = target - min > window ? target - window : min;
+            const uint64_t hi = max - target > window ? target + window : max;
+
+            // alignment shrinks area by aligning both towards middle so we don't allocate beyond the given bounds
+            const uint64_t start = AlignUpwards(std::max<uint64_t>(lo, alignment), static_cast<size_t>(alignment));
+            const uint64_t end = AlignDownwards(hi, static_cast<size_t>(alignment));
+            if (start >= end || end - start < chunkSize)
+                continue;
+
+            const uint64_t chunk = boundedAllocSupported()
+                                       ? boundAlloc(start, end, chunkSize)
+                                       : boundAllocLegacy(start, end, chunkSize);
+            if (!chunk)
+                continue;
+
+            if (chunk < min || chunk + chunkSize > max)
+            {
+                // same WINE workaround as the detour schemes, the range isn't always honoured
+                boundAllocFree(chunk, chunkSize);
+                continue;
+            }
+
+            Chunk& entry = m_chunks[chunk];
+            entry.end = chunk + chunkSize;
+            entry.free.emplace(chunk, chunkSize);
+            PLH_LOG("Near code heap reserved " + int_to_hex(chunk) + " for " + int_to_hex(target), ErrorLevel::INFO);
+            return chunk;
+        }
+        return 0;
+    }
+}
@@ -1,33 +1,22 @@
 #include "polyhook2/RangeAllocator.hpp"
 #include "polyhook2/PolyHookOsIncludes.hpp"
 
-PLH::FBAllocator::FBAllocator(uint64_t min, uint64_t max, uint8_t blockSize, uint8_t blockCount) : m_allocator(nullptr),
-    m_hAllocator(nullptr)
+PLH::FBAllocator::FBAllocator(uint64_t min, uint64_t max, uint16_t blockSize, uint32_t blockCount) :
+    m_freeHead(FREE_EMPTY), m_poolIndex(0), m_usedBlocks(0), m_maxUsedBlocks(0)
 {
     m_min = min;
     m_max = max;
     m_dataPool = 0;
     m_maxBlocks = blockCount;
-    m_usedBlocks = 0;
     m_blockSize = blockSize;
     m_alloc2Supported = boundedAllocSupported();
 }
 
 PLH::FBAllocator::~FBAllocator()
 {
-    uint64_t freeSize = 0;
-
-    if (m_allocator)
-    {
-        freeSize = m_allocator->blockSize * m_allocator->maxBlocks;
-        delete m_allocator;
-        m_allocator = nullptr;
-        m_hAllocator = nullptr;
-    }
-
     if (m_dataPool)
     {
-        boundAllocFree(m_dataPool, freeSize);
+        boundAllocFree(m_dataPool, poolEnd() - m_dataPool);
         m_dataPool = 0;
     }
 }
@@ -56,39 +45,89 @@ bool PLH::FBAllocator::initialize()
         }
     }
 
-    m_allocator = new ALLOC_Allocator{
-        "PLH", (char*)m_dataPool,
-        m_blockSize, ALLOC_BLOCK_SIZE(m_blockSize), m_maxBlocks, nullptr, 0, 0, 0, 0, 0
-    };
-    if (!m_allocator)
-    {
-        return false;
-    }
-
-    m_hAllocator = m_allocator;
+    m_freeNext = std::make_unique<std::atomic<uint32_t>[]>(m_maxBlocks);
     return true;
 }
 
+uint64_t PLH::FBAllocator::poolEnd() const
+{
+    return m_dataPool + ALLOC_BLOCK_SIZE(m_blockSize) * static_cast<uint64_t>(m_maxBlocks);
+}
+
+char* PLH::FBAllocator::blockAt(const uint32_t index) const
+{
+    return (char*)(m_dataPool + ALLOC_BLOCK_SIZE(m_blockSize) * static_cast<uint64_t>(index));
+}
+
+void PLH::FBAllocator::countAllocation()
+{
+    const uint32_t used = m_usedBlocks.fetch_add(1, std::memory_order_relaxed) + 1;
+    uint32_t peak = m_maxUsedBlocks.load(std::memory_order_relaxed);
+    while (used > peak && !m_maxUsedBlocks.compare_exchange_weak(peak, used, std::memory_order_relaxed));
+}
+
 char* PLH::FBAllocator::allocate()
 {
-    if (m_usedBlocks + 1 == m_maxBlocks)
+    if (!m_dataPool)
     {
         return nullptr;
     }
-    m_usedBlocks++;
-    return static_cast<char*>(ALLOC_Alloc(m_hAllocator, m_blockSize));
+
+    // reuse a returned block first
+    uint64_t head = m_freeHead.load(std::memory_order_acquire);
+    while ((head & 0xFFFFFFFF) != FREE_EMPTY)
+    {
+        const uint32_t top = static_cast<uint32_t>(head & 0xFFFFFFFF) - 1;
+        const uint64_t next = ((head >> 32) + 1) << 32 | m_freeNext[top].load(std::memory_order_relaxed);
+        if (m_freeHead.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire))
+        {
+            countAllocation();
+            return blockAt(top);
+        }
+    }
+
+    // then one never handed out
+    uint32_t index = m_poolIndex.load(std::memory_order_relaxed);
+    while (index < m_maxBlocks)
+    {
+        if (m_poolIndex.compare_exchange_weak(index, index + 1, std::memory_order_relaxed))
+        {
+            countAllocation();
+            return blockAt(index);
+        }
+    }
+    return nullptr;
 }
 
-char* PLH::FBAllocator::callocate(uint8_t num)
+char* PLH::FBAllocator::callocate(uint32_t num)
 {
-    m_usedBlocks += num;
-    return static_cast<char*>(ALLOC_Calloc(m_hAllocator, num, m_blockSize));
+    // a single block, zeroed, num * blockSize must fit in it
+    assert(static_cast<uint64_t>(num) * m_blockSize <= ALLOC_BLOCK_SIZE(m_blockSize));
+    const auto mem = allocate();
+    if (mem)
+    {
+        memset(mem, 0, static_cast<size_t>(num) * m_blockSize);
+    }
+    return mem;
 }
 
 void PLH::FBAllocator::deallocate(char* mem)
 {
-    m_usedBlocks--;
-    ALLOC_Free(m_hAllocator, mem);
+    if (!mem)
+        return;
+
+    assert((uint64_t)mem >= m_dataPool && (uint64_t)mem < poolEnd());
+    const auto index = static_cast<uint32_t>(((uint64_t)mem - m_dataPool) / ALLOC_BLOCK_SIZE(m_blockSize));
+
+    uint64_t head = m_freeHead.load(std::memory_order_relaxed);
+    do
+    {
+        m_freeNext[index].store(static_cast<uint32_t>(head & 0xFFFFFFFF), std::memory_order_relaxed);
+    }
+    while (!m_freeHead.compare_exchange_weak(head, ((head >> 32) + 1) << 32 | (index + 1), std::memory_order_release,
+                                             std::memory_order_relaxed));
+
+    m_usedBlocks.fetch_sub(1, std::memory_order_relaxed);
 }
 
 bool PLH::FBAllocator::inRange(uint64_t addr)
@@ -118,31 +157,47 @@ uint8_t PLH::FBAllocator::intersectionLoadFactor(uint64_t min, uint64_t max)
     return static_cast<uint8_t>((intersectLength / (max - min)) * 100.0);
 }
 
-PLH::RangeAllocator::RangeAllocator(uint8_t blockSize, uint8_t blockCount)
+PLH::RangeAllocator::RangeAllocator(uint16_t blockSize, uint32_t blockCount)
 {
     m_maxBlocks = blockCount;
     m_blockSize = blockSize;
 }
 
-std::shared_ptr<PLH::FBAllocator> PLH::RangeAllocator::findOrInsertAllocator(uint64_t min, uint64_t max)
+std::shared_ptr<PLH::FBAllocator> PLH::RangeAllocator::findFreeAllocator(uint64_t min, uint64_t max,
+                                                                          uint64_t target) const
 {
-    for (auto& allocator : m_allocators)
+    // the pool starting at or above target and the one below it are the nearest on each side. Every pool
+    // has the same size, so if the one above ends past max all later ones do too
+    const auto hi = m_freeAllocators.lower_bound(std::max(target, min));
+    const bool hiValid = hi != m_freeAllocators.end() && hi->second->poolEnd() <= max;
+    const bool loValid = hi != m_freeAllocators.begin() && std::prev(hi)->first >= min &&
+        std::prev(hi)->second->poolEnd() <= max;
+
+    if (hiValid && loValid)
     {
-        if (allocator->inRange(min) && allocator->inRange(max - 1))
-        {
-            return allocator;
-        }
+        const uint64_t loEnd = std::prev(hi)->second->poolEnd();
+        const uint64_t loDistance = loEnd > target ? 0 : target - loEnd;
+        return hi->first - target <= loDistance ? hi->second : std::prev(hi)->second;
     }
 
-    auto allocator = std::make_shared<FBAllocator>(min, max, m_blockSize, m_maxBlocks);
-    if (!allocator->initialize())
-        return nullptr;
+    if (hiValid)
+    {
+        return hi->second;
+    }
 
-    m_allocators.push_back(allocator);
-    return allocator;
+    if (loValid)
+    {
+        return std::prev(hi)->second;
+    }
+    return nullptr;
 }
 
 char* PLH::RangeAllocator::allocate(uint64_t min, uint64_t max)
+{
+    return allocate(min, max, min);
+}
+
+char* PLH::RangeAllocator::allocate(uint64_t min, uint64_t max, uint64_t target)
 {
     static bool is32 = sizeof(void*) == 4;
     if (is32 && max > 0x7FFFFFFF)
@@ -150,35 +205,96 @@ char* PLH::RangeAllocator::allocate(uint64_t min, uint64_t max)
         max = 0x7FFFFFFF; // allocator apis fail in 32bit above this range
     }
 
-    std::lock_guard<std::mutex> m_lock(m_mutex);
-    const auto allocator = findOrInsertAllocator(min, max);
-    if (!allocator)
+    if (min >= max)
     {
         return nullptr;
     }
+    target = std::clamp(target, min, max - 1);
+
+    {
+        std::shared_lock<std::shared_mutex> m_lock(m_mutex);
+        if (const auto allocator = findFreeAllocator(min, max, target))
+        {
+            if (char* addr = allocator->allocate())
+            {
+                return addr;
+            }
+        }
+    }
+
+    // no pool with room that we know of: drop the full ones from the hint, or make a new pool
+    std::unique_lock<std::shared_mutex> m_lock(m_mutex);
+    while (const auto allocator = findFreeAllocator(min, max, target))
+    {
+        if (char* addr = allocator->allocate())
+        {
+            return addr;
+        }
+        m_freeAllocators.erase(allocator->poolStart());
+    }
 
-    char* addr = allocator->allocate();
-    m_allocMap[(uint64_t)addr] = allocator;
-    return addr;
+    // try a tight window around target first so the new pool lands close, then the whole range
+    constexpr uint64_t windows[] = {0x10000000, std::numeric_limits<uint64_t>::max()};
+    for (const uint64_t window : windows)
+    {
+        const uint64_t lo = target - min > window ? target - window : min;
+        const uint64_t hi = max - target > window ? target + window : max;
+
+        auto allocator = std::make_shared<FBAllocator>(lo, hi, m_blockSize, m_maxBlocks);
+        if (!allocator->initialize())
+            continue;
+
+        m_allocators.emplace(allocator->poolStart(), allocator);
+        m_freeAllocators.emplace(allocator->poolStart(), allocator);
+        return allocator->allocate();
+    }
+    return nullptr;
+}
+
+bool PLH::RangeAllocator::owns(uint64_t addr) const
+{
+    std::shared_lock<std::shared_mutex> m_lock(m_mutex);
+    auto it = m_allocators.upper_bound(addr);
+    return it != m_allocators.begin() && addr < std::prev(it)->second->poolEnd();
 }
 
 void PLH::RangeAllocator::deallocate(uint64_t addr)
 {
-    std::lock_guard<std::mutex> m_lock(m_mutex);
-    if (const auto it{m_allocMap.find(addr)}; it != std::end(m_allocMap))
+    std::shared_ptr<FBAllocator> allocator;
     {
-        const auto allocator = it->second;
-        allocator->deallocate((char*)addr);
-        m_allocMap.erase(addr);
+        std::shared_lock<std::shared_mutex> m_lock(m_mutex);
+
+        // owning pool is the last one starting at or below addr
+        auto it = m_allocators.upper_bound(addr);
+        if (it == m_allocators.begin() || (--it, addr >= it->second->poolEnd()))
+        {
+            assert(false);
+            return;
+        }
 
-        // this instance + instance in m_allocators array
-        if (allocator.use_count() == 2)
+        allocator = it->second;
+        allocator->deallocate((char*)addr);
+        if (!allocator->isEmpty() && m_freeAllocators.count(allocator->poolStart()))
         {
-            std::erase(m_allocators, allocator);
+            return;
         }
     }
+
+    // pool became empty or regained room, allocations only happen under the shared lock so its state is stable here
+    std::unique_lock<std::shared_mutex> m_lock(m_mutex);
+    const auto it = m_allocators.find(allocator->poolStart());
+    if (it == m_allocators.end() || it->second != allocator)
+    {
+        return; // another thread already retired it
+    }
+
+    if (allocator->isEmpty())
+    {
+        m_freeAllocators.erase(allocator->poolStart());
+        m_allocators.erase(it);
+    }
     else
     {
-        assert(false);
+        m_freeAllocators.emplace(allocator->poolStart(), allocator);
     }
 }
@@ -10,6 +10,7 @@ PLH::VFuncSwapHook::VFuncSwapHook(const uint64_t Class, const VFuncMap& redirect
     : m_class(Class)
       , m_vtable(nullptr)
       , m_vFuncCount(0)
+      , m_knownVFuncCount(0)
       , m_redirectMap(redirectMap)
       , m_userOrigMap(userOrigMap)
 {
@@ -18,6 +19,13 @@ PLH::VFuncSwapHook::VFuncSwapHook(const uint64_t Class, const VFuncMap& redirect
 bool PLH::VFuncSwapHook::hook()
 {
     assert(m_userOrigMap != nullptr);
+    const auto start = HookEvents::singleton().startTiming();
+    bool success = false;
+    auto publish = finally([&]()
+    {
+        publishEvent(HookEvent::Kind::Install, success, start);
+    });
+
     MemoryProtector prot(m_class, sizeof(void*), R | W, *this);
     m_vtable = *(uintptr_t**)m_class;
     m_vFuncCount = countVFuncs();
@@ -38,6 +46,7 @@ bool PLH::VFuncSwapHook::hook()
     }
 
     m_hooked = true;
+    success = true;
     return true;
 }
 
@@ -45,6 +54,13 @@ bool PLH::VFuncSwapHook::unHook()
 {
     assert(m_userOrigMap != nullptr);
     assert(m_hooked);
+    const auto start = HookEvents::singleton().startTiming();
+    bool success = false;
+    auto publish = finally([&]()
+    {
+        publishEvent(HookEvent::Kind::Uninstall, success, start);
+    });
+
     if (!m_hooked)
     {
         PLH_LOG("vfuncswap unhook failed: no hook present", ErrorLevel::SEV);
@@ -65,17 +81,30 @@ bool PLH::VFuncSwapHook::unHook()
     m_userOrigMap->clear();
 
     m_hooked = false;
+    success = true;
     return true;
 }
 
+void PLH::VFuncSwapHook::publishEvent(const HookEvent::Kind kind, const bool success,
+                                      const HookEvents::Start& start) const
+{
+    if (!start)
+        return;
+
+    HookEvent event{};
+    event.kind = kind;
+    event.success = success;
+    event.type = getType();
+    event.fnAddress = m_class;
+    event.prologueSize = m_vFuncCount;
+    event.trampoline = (uint64_t)m_vtable;
+    HookEvents::singleton().publish(event, start);
+}
+
 uint16_t PLH::VFuncSwapHook::countVFuncs()
 {
-    uint16_t count = 0;
-    for (;; count++)
-    {
-        // if you have more than 500 vfuncs you have a problem and i don't support you :)
-        if (!IsValidPtr((void*)m_vtable[count]) || count > 500)
-            break;
-    }
-    return count;
+    if (m_knownVFuncCount > 0)
+        return m_knownVFuncCount;
+
+    return VTableInfo::singleton().countVFuncs(m_vtable);
 }
@@ -0,0 +1,87 @@
+#include "polyhook2/Virtuals/VTableInfo.hpp"
+#include "polyhook2/ErrorLog.hpp"
+
+namespace
+{
+    bool isExecutable(const uint64_t address, std::optional<PLH::MemRegion>& lastRegion)
+    {
+        // slots mostly point into the same module, only look the region up when leaving the last one
+        if (!lastRegion || address < lastRegion->start || address >= lastRegion->end)
+        {
+            lastRegion = PLH::MemRegionMap::singleton().find(address);
+        }
+        return lastRegion && (lastRegion->prot & PLH::ProtFlag::X);
+    }
+}
+
+PLH::VTableInfo& PLH::VTableInfo::singleton()
+{
+    static VTableInfo info;
+    return info;
+}
+
+uint16_t PLH::VTableInfo::countVFuncs(const uintptr_t* vtable)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto it = m_counts.find(vtable);
+    if (it != m_counts.end())
+        return it->second;
+
+    const uint16_t count = measure(vtable);
+    if (count > 0)
+    {
+        m_counts.emplace(vtable, count);
+    }
+    return count;
+}
+
+void PLH::VTableInfo::setVFuncCount(const uintptr_t* vtable, const uint16_t count)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_counts[vtable] = count;
+}
+
+void PLH::VTableInfo::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_counts.clear();
+}
+
+uint16_t PLH::VTableInfo::measure(const uintptr_t* vtable)
+{
+    const auto address = (uint64_t)vtable;
+    const auto region = MemRegionMap::singleton().find(address);
+    if (!region || !(region->prot & ProtFlag::R))
+    {
+        PLH_LOG("vtable is not in readable memory", ErrorLevel::SEV);
+        return 0;
+    }
+
+    std::optional<MemRegion> lastRegion;
+
+#if !defined(_MSC_VER)
+    // Itanium: [-2] offset-to-top, [-1] typeinfo (null without RTTI), [0] first virtual function
+    if (address - region->start >= 2 * sizeof(uintptr_t))
+    {
+        const auto offsetToTop = (intptr_t)vtable[-2];
+        const uintptr_t typeInfo = vtable[-1];
+        if (offsetToTop > 0 || offsetToTop % (intptr_t)sizeof(uintptr_t) != 0 ||
+            (typeInfo != 0 && isExecutable(typeInfo, lastRegion)))
+        {
+            PLH_LOG("vtable has no offset-to-top and typeinfo header, not the start of a vtable", ErrorLevel::SEV);
+            return 0;
+        }
+    }
+#endif
+
+    // never read past the mapping, the table cannot continue into another one
+    const uint64_t slots = std::min<uint64_t>((region->end - address) / sizeof(uintptr_t), MAX_VFUNCS);
+
+    uint16_t count = 0;
+    for (; count < slots; count++)
+    {
+        if (!isExecutable(vtable[count], lastRegion))
+            break;
+    }
+    return count;
+}
@@ -1,6 +1,32 @@
 #include "polyhook2/Virtuals/VTableSwapHook.hpp"
 #include "polyhook2/ErrorLog.hpp"
 
+namespace
+{
+    // redirected clone used by every shared hook on objects with the same original vtable
+    struct SharedVTable
+    {
+        std::unique_ptr<uintptr_t[]> vtable;
+        uint16_t vFuncCount;
+        PLH::VFuncMap redirectMap;
+        PLH::VFuncMap origMap;
+        uint32_t refs;
+    };
+
+    struct SharedVTableRegistry
+    {
+        std::mutex mutex;
+        std::unordered_map<uintptr_t*, SharedVTable> vtables;
+    };
+
+    SharedVTableRegistry& sharedRegistry()
+    {
+        // never destroyed, hooks living in other statics may unhook after it otherwise would be
+        static auto* registry = new SharedVTableRegistry();
+        return *registry;
+    }
+}
+
 PLH::VTableSwapHook::VTableSwapHook(const char* Class, const VFuncMap& redirectMap, VFuncMap* userOrigMap)
     : VTableSwapHook((uint64_t)Class, redirectMap, userOrigMap)
 {
@@ -16,6 +42,8 @@ PLH::VTableSwapHook::VTableSwapHook(const uint64_t Class, const VFuncMap& redire
       , m_origVtable(nullptr)
       , m_class(Class)
       , m_vFuncCount(0)
+      , m_knownVFuncCount(0)
+      , m_shared(false)
       , m_redirectMap(redirectMap)
       , m_userOrigMap(userOrigMap)
 {
@@ -25,12 +53,25 @@ bool PLH::VTableSwapHook::hook()
 {
     assert(m_userOrigMap != nullptr);
     assert(!m_hooked);
+    const auto start = HookEvents::singleton().startTiming();
+    bool success = false;
+    auto publish = finally([&]()
+    {
+        publishEvent(HookEvent::Kind::Install, success, start);
+    });
+
     if (m_hooked)
     {
         PLH_LOG("vtable hook failed: hook already present", ErrorLevel::SEV);
         return false;
     }
 
+    if (m_shared)
+    {
+        success = hookShared();
+        return success;
+    }
+
     MemoryProtector prot(m_class, sizeof(void*), R | W, *this);
     m_origVtable = *(uintptr_t**)m_class;
     m_vFuncCount = countVFuncs();
@@ -64,6 +105,7 @@ bool PLH::VTableSwapHook::hook()
 
     *(uint64_t**)m_class = (uint64_t*)m_newVtable.get();
     m_hooked = true;
+    success = true;
     PLH_LOG("vtable hooked", ErrorLevel::INFO);
     return true;
 }
@@ -71,15 +113,24 @@ bool PLH::VTableSwapHook::hook()
 bool PLH::VTableSwapHook::unHook()
 {
     assert(m_hooked);
+    const auto start = HookEvents::singleton().startTiming();
     if (!m_hooked)
     {
         PLH_LOG("vtable unhook failed: no hook present", ErrorLevel::SEV);
+        publishEvent(HookEvent::Kind::Uninstall, false, start);
         return false;
     }
 
-    MemoryProtector prot(m_class, sizeof(void*), R | W, *this);
-    *(uint64_t**)m_class = (uint64_t*)m_origVtable;
-
+    if (m_shared)
+    {
+        *(uint64_t**)m_class = (uint64_t*)m_origVtable;
+        releaseShared();
+    }
+    else
+    {
+        MemoryProtector prot(m_class, sizeof(void*), R | W, *this);
+        *(uint64_t**)m_class = (uint64_t*)m_origVtable;
+    }
     m_newVtable.reset();
 
     m_hooked = false;
@@ -88,17 +139,120 @@ bool PLH::VTableSwapHook::unHook()
     m_userOrigMap->clear();
 
     PLH_LOG("vtable unhooked", ErrorLevel::INFO);
+    publishEvent(HookEvent::Kind::Uninstall, true, start);
     return true;
 }
 
-uint16_t PLH::VTableSwapHook::countVFuncs()
+void PLH::VTableSwapHook::publishEvent(const HookEvent::Kind kind, const bool success,
+                                       const HookEvents::Start& start) const
+{
+    if (!start)
+        return;
+
+    HookEvent event{};
+    event.kind = kind;
+    event.success = success;
+    event.type = getType();
+    event.fnAddress = m_class;
+    event.prologueSize = m_vFuncCount;
+    event.trampoline = *(uint64_t*)m_class;
+    HookEvents::singleton().publish(event, start);
+}
+
+void PLH::VTableSwapHook::setSharedVTable(const bool shared)
 {
-    uint16_t count = 0;
-    for (;; count++)
+    // unHook picks its path from this, it must match how the hook was installed
+    assert(!m_hooked);
+    if (m_hooked)
     {
-        // if you have more than 500 vfuncs you have a problem and i don't support you :)
-        if (!IsValidPtr((void*)m_origVtable[count]) || count > 500)
-            break;
+        PLH_LOG("vtable shared mode can't change while hooked", ErrorLevel::SEV);
+        return;
     }
-    return count;
+    m_shared = shared;
+}
+
+bool PLH::VTableSwapHook::hookShared()
+{
+    // the object is ordinary writable memory, only the clone is shared, so no protection change is needed
+    m_origVtable = *(uintptr_t**)m_class;
+
+    auto& registry = sharedRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    auto it = registry.vtables.find(m_origVtable);
+    if (it == registry.vtables.end())
+    {
+        m_vFuncCount = countVFuncs();
+        assert(m_vFuncCount > 0);
+        if (m_vFuncCount <= 0)
+        {
+            PLH_LOG("vtable hook failed: class has no virtual functions", ErrorLevel::SEV);
+            m_origVtable = nullptr;
+            return false;
+        }
+
+        SharedVTable shared{};
+        shared.vtable.reset(new uintptr_t[m_vFuncCount]);
+        shared.vFuncCount = m_vFuncCount;
+        shared.redirectMap = m_redirectMap;
+        memcpy(shared.vtable.get(), m_origVtable, sizeof(uintptr_t) * m_vFuncCount);
+
+        for (const auto& p : m_redirectMap)
+        {
+            assert(p.first < m_vFuncCount);
+            if (p.first >= m_vFuncCount)
+            {
+                PLH_LOG("vtable hook failed: index exceeds virtual function count", ErrorLevel::SEV);
+                m_origVtable = nullptr;
+                m_userOrigMap->clear();
+                return false;
+            }
+
+            shared.origMap[p.first] = static_cast<uint64_t>(shared.vtable[p.first]);
+            shared.vtable[p.first] = static_cast<uintptr_t>(p.second);
+        }
+
+        it = registry.vtables.emplace(m_origVtable, std::move(shared)).first;
+    }
+    else if (it->second.redirectMap != m_redirectMap)
+    {
+        PLH_LOG("vtable hook failed: shared vtable is already redirected differently", ErrorLevel::SEV);
+        m_origVtable = nullptr;
+        return false;
+    }
+
+    SharedVTable& shared = it->second;
+    shared.refs++;
+    m_vFuncCount = shared.vFuncCount;
+    *m_userOrigMap = shared.origMap;
+
+    // redirects only this object, every sharing hook stores the same clone into its own object
+    *(uint64_t**)m_class = (uint64_t*)shared.vtable.get();
+    m_hooked = true;
+    PLH_LOG("vtable hooked (shared)", ErrorLevel::INFO);
+    return true;
+}
+
+void PLH::VTableSwapHook::releaseShared()
+{
+    auto& registry = sharedRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    const auto it = registry.vtables.find(m_origVtable);
+    assert(it != registry.vtables.end());
+    if (it == registry.vtables.end())
+        return;
+
+    if (--it->second.refs == 0)
+    {
+        registry.vtables.erase(it);
+    }
+}
+
+uint16_t PLH::VTableSwapHook::countVFuncs()
+{
+    if (m_knownVFuncCount > 0)
+        return m_knownVFuncCount;
+
+    return VTableInfo::singleton().countVFuncs(m_origVtable);
 }
@@ -37,6 +37,46 @@ PLH::ZydisDisassembler::~ZydisDisassembler()
     }
 }
 
+std::optional<PLH::Instruction> PLH::ZydisDisassembler::decodeOne(uint8_t* buf, const size_t avail,
+                                                                   const uint64_t address)
+{
+    ZydisDecodedOperand decoded_operands[ZYDIS_MAX_OPERAND_COUNT];
+    ZydisDecodedInstruction insInfo;
+    if (!ZYAN_SUCCESS(ZydisDecoderDecodeFull(m_decoder, buf, static_cast<ZyanUSize>(avail), &insInfo,
+        decoded_operands)))
+    {
+        return {};
+    }
+
+    Instruction::Displacement displacement = {};
+    displacement.Absolute = 0;
+
+    Instruction inst(address,
+                     displacement,
+                     0,
+                     false,
+                     false,
+                     buf,
+                     insInfo.length,
+                     insInfo.mnemonic,
+                     "",
+                     m_mode);
+
+    setDisplacementFields(inst, &insInfo, decoded_operands);
+
+    for (int i = 0; i < insInfo.operand_count; i++)
+    {
+        auto op = decoded_operands[i];
+        if (op.type == ZYDIS_OPERAND_TYPE_MEMORY && op.mem.type == ZYDIS_MEMOP_TYPE_MEM && op.mem.disp.
+            has_displacement && op.mem.base == ZYDIS_REGISTER_NONE && op.mem.segment != ZYDIS_REGISTER_DS && inst.
+            isIndirect())
+        {
+            inst.setIndirect(false);
+        }
+    }
+    return inst;
+}
+
 PLH::insts_t PLH::ZydisDisassembler::disassemble(
     uint64_t firstInstruction,
     uint64_t start,
@@ -62,68 +102,163 @@ PLH::insts_t PLH::ZydisDisassembler::disassemble(
         delete[] buf;
         return insVec;
     }
-    ZydisDecodedOperand decoded_operands[ZYDIS_MAX_OPERAND_COUNT];
-    ZydisDecodedInstruction insInfo;
+
+    BranchIndex index;
+    if (m_decodeCache)
+    {
+        if (auto cached = m_decodeCache->lookup(firstInstruction, start, end, m_mode, buf, read))
+        {
+            delete[] buf;
+
+            // replay the branch map bookkeeping a real decode would have done
+            insVec.reserve(cached->size());
+            for (auto& inst : *cached)
+            {
+                insVec.push_back(std::move(inst));
+                addToBranchMap(insVec, index);
+            }
+            return insVec;
+        }
+    }
+
     uint64_t offset = 0;
     bool endHit = false;
-    while (ZYAN_SUCCESS(
-        ZydisDecoderDecodeFull(m_decoder, buf + offset, static_cast<ZyanUSize>(read - offset), &insInfo,
-            decoded_operands)))
+    while (offset < read)
     {
-        Instruction::Displacement displacement = {};
-        displacement.Absolute = 0;
+        const uint64_t address = start + offset;
+        auto inst = decodeOne(buf + offset, static_cast<size_t>(read - offset), address);
+        if (!inst || (endHit && !isPadBytes(*inst)))
+        {
+            break;
+        }
 
-        uint64_t address = start + offset;
+        offset += inst->size();
+        insVec.push_back(std::move(*inst));
 
-        std::string opstr;
-        if (!getOpStr(&insInfo, decoded_operands, address, &opstr))
+        // links the new instruction with the ones it branches to or is branched to from
+        addToBranchMap(insVec, index);
+        if (isFuncEnd(insVec.back(), start == address))
         {
-            break;
+            endHit = true;
         }
+    }
+
+    if (m_decodeCache)
+        m_decodeCache->store(firstInstruction, start, end, m_mode, buf, read, insVec);
+
+    delete[] buf;
+    return insVec;
+}
 
+PLH::insts_t PLH::ZydisDisassembler::disassembleRegion(uint64_t start, uint64_t end, const MemAccessor& accessor)
+{
+    insts_t insVec;
+    if (end <= start)
+        return insVec;
 
-        Instruction inst(address,
-                         displacement,
-                         0,
-                         false,
-                         false,
-                         buf + offset,
-                         insInfo.length,
-                         ZydisMnemonicGetString(insInfo.mnemonic),
-                         opstr,
-                         m_mode);
+    size_t read = 0;
+    std::vector<uint8_t> buf(static_cast<size_t>(end - start));
+    if (!accessor.safe_mem_read(start, (uint64_t)buf.data(), buf.size(), read))
+        return insVec;
 
-        setDisplacementFields(inst, &insInfo, decoded_operands);
-        if (endHit && !isPadBytes(inst))
+    // no function end detection, undecodable bytes are stepped over one at a time
+    BranchIndex index;
+    uint64_t offset = 0;
+    while (offset < read)
+    {
+        auto inst = decodeOne(buf.data() + offset, static_cast<size_t>(read - offset), start + offset);
+        if (!inst)
         {
-            break;
+            offset++;
+            continue;
         }
 
-        for (int i = 0; i < insInfo.operand_count; i++)
+        offset += inst->size();
+        insVec.push_back(std::move(*inst));
+        addToBranchMap(insVec, index);
+    }
+    return insVec;
+}
+
+PLH::insts_t PLH::ZydisDisassembler::disassembleFunction(uint64_t start, const MemAccessor& accessor,
+                                                         uint64_t maxSize)
+{
+    insts_t insVec;
+    size_t read = 0;
+    std::vector<uint8_t> buf(static_cast<size_t>(maxSize));
+    if (maxSize == 0 || !accessor.safe_mem_read(start, (uint64_t)buf.data(), buf.size(), read))
+        return insVec;
+
+    // follow control flow from start, every direct jump target inside the window starts another path
+    std::map<uint64_t, Instruction> decoded;
+    std::vector<uint64_t> work{0};
+    while (!work.empty())
+    {
+        uint64_t offset = work.back();
+        work.pop_back();
+
+        while (offset < read && !decoded.contains(start + offset))
         {
-            auto op = decoded_operands[i];
-            if (op.type == ZYDIS_OPERAND_TYPE_MEMORY && op.mem.type == ZYDIS_MEMOP_TYPE_MEM && op.mem.disp.
-                has_displacement && op.mem.base == ZYDIS_REGISTER_NONE && op.mem.segment != ZYDIS_REGISTER_DS && inst.
-                isIndirect())
+            auto inst = decodeOne(buf.data() + offset, static_cast<size_t>(read - offset), start + offset);
+            if (!inst)
+                break;
+
+            if (inst->isBranching() && !inst->isCalling() && !inst->isIndirect() && inst->hasDisplacement())
             {
-                inst.setIndirect(false);
+                const uint64_t dest = inst->getDestination();
+                if (dest >= start && dest < start + read)
+                    work.push_back(dest - start);
             }
+
+            const bool end = isFuncEnd(*inst);
+            offset += inst->size();
+            decoded.emplace(inst->getAddress(), std::move(*inst));
+            if (end)
+                break;
         }
+    }
 
-        insVec.push_back(inst);
+    BranchIndex index;
+    insVec.reserve(decoded.size());
+    for (auto& [address, inst] : decoded)
+    {
+        insVec.push_back(std::move(inst));
+        addToBranchMap(insVec, index);
+    }
+    return insVec;
+}
+
+void PLH::ZydisDisassembler::addToBranchMap(insts_t& insVec, BranchIndex& index)
+{
+    const size_t newIdx = insVec.size() - 1;
+    const Instruction& inst = insVec[newIdx];
+    index.starts.emplace(inst.getAddress(), newIdx);
 
-        // searches instruction vector and updates references
-        addToBranchMap(insVec, inst);
-        if (isFuncEnd(inst, start == address))
+    // new instruction points back to an older one (one to one)
+    if (inst.isBranching())
+    {
+        const auto dest = index.starts.find(inst.getDestination());
+        if (dest != index.starts.end())
         {
-            endHit = true;
+            updateBranchMap(dest->first, inst);
         }
+    }
 
-        offset += insInfo.length;
+    // older instructions pointing forward to this one (many to one possible)
+    const auto waiting = index.pending.find(inst.getAddress());
+    if (waiting != index.pending.end())
+    {
+        for (const size_t idx : waiting->second)
+        {
+            updateBranchMap(inst.getAddress(), insVec[idx]);
+        }
+        index.pending.erase(waiting);
     }
 
-    delete[] buf;
-    return insVec;
+    if (inst.isBranching() && inst.hasDisplacement() && !index.starts.contains(inst.getDestination()))
+    {
+        index.pending[inst.getDestination()].push_back(newIdx);
+    }
 }
 
 bool PLH::ZydisDisassembler::getOpStr(ZydisDecodedInstruction* pInstruction,
@@ -143,6 +278,57 @@ bool PLH::ZydisDisassembler::getOpStr(ZydisDecodedInstruction* pInstruction,
     return false;
 }
 
+std::string PLH::ZydisDisassembler::formatOperands(const Instruction& instruction)
+{
+    // one formatter per mode and thread, the instruction carries everything else
+    thread_local ZydisDisassembler x64(Mode::x64);
+    thread_local ZydisDisassembler x86(Mode::x86);
+    ZydisDisassembler& disasm = instruction.getMode() == Mode::x64 ? x64 : x86;
+
+    ZydisDecodedOperand decoded_operands[ZYDIS_MAX_OPERAND_COUNT];
+    ZydisDecodedInstruction insInfo;
+    std::string opstr;
+    if (!ZYAN_SUCCESS(ZydisDecoderDecodeFull(disasm.m_decoder, instruction.getRawBytes(),
+        static_cast<ZyanUSize>(instruction.size()), &insInfo, decoded_operands)) ||
+        !disasm.getOpStr(&insInfo, decoded_operands, instruction.getAddress(), &opstr))
+    {
+        return "??";
+    }
+    return opstr;
+}
+
+std::string PLH::Instruction::getFullName() const
+{
+    if (m_opLabel[0] != '\0')
+        return getMnemonic() + " " + m_opLabel;
+
+    // hand written data such as a dest holder has no mnemonic id and no operands to format
+    if (m_mnemonicId == ZYDIS_MNEMONIC_INVALID)
+        return getMnemonic();
+    return getMnemonic() + " " + ZydisDisassembler::formatOperands(*this);
+}
+
+ZydisMnemonic PLH::mnemonicFromString(const std::string& mnemonic)
+{
+    static const auto lookup = []()
+    {
+        std::unordered_map<std::string, ZydisMnemonic> table;
+        for (int i = ZYDIS_MNEMONIC_INVALID + 1; i <= ZYDIS_MNEMONIC_MAX_VALUE; i++)
+        {
+            const auto id = static_cast<ZydisMnemonic>(i);
+            if (const char* str = ZydisMnemonicGetString(id))
+                table.emplace(str, id);
+        }
+        return table;
+    }();
+
+    if (mnemonic.empty())
+        return ZYDIS_MNEMONIC_INVALID;
+
+    const auto it = lookup.find(mnemonic);
+    return it == lookup.end() ? ZYDIS_MNEMONIC_INVALID : it->second;
+}
+
 void PLH::ZydisDisassembler::setDisplacementFields(Instruction& inst, const ZydisDecodedInstruction* zydisInst,
                                                    const ZydisDecodedOperand* operands) const
 {
@@ -182,14 +368,14 @@ void PLH::ZydisDisassembler::setDisplacementFields(Instruction& inst, const Zydi
                     inst.setRelativeDisplacement(operand->mem.disp.value);
                 }
 
-                if ((zydisInst->mnemonic == ZYDIS_MNEMONIC_JMP && inst.size() >= 2 && inst.getBytes().at(0) == 0xff &&
-                        inst.getBytes().at(1) == 0x25) ||
-                    (zydisInst->mnemonic == ZYDIS_MNEMONIC_CALL && inst.size() >= 2 && inst.getBytes().at(0) == 0xff &&
-                        inst.getBytes().at(1) == 0x15) ||
-                    (zydisInst->mnemonic == ZYDIS_MNEMONIC_CALL && inst.size() >= 3 && inst.getBytes().at(1) == 0xff &&
-                        inst.getBytes().at(2) == 0x15) ||
-                    (zydisInst->mnemonic == ZYDIS_MNEMONIC_JMP && inst.size() >= 3 && inst.getBytes().at(1) == 0xff &&
-                        inst.getBytes().at(2) == 0x25)
+                if ((zydisInst->mnemonic == ZYDIS_MNEMONIC_JMP && inst.size() >= 2 && inst.getRawBytes()[0] == 0xff &&
+                        inst.getRawBytes()[1] == 0x25) ||
+                    (zydisInst->mnemonic == ZYDIS_MNEMONIC_CALL && inst.size() >= 2 && inst.getRawBytes()[0] == 0xff &&
+                        inst.getRawBytes()[1] == 0x15) ||
+                    (zydisInst->mnemonic == ZYDIS_MNEMONIC_CALL && inst.size() >= 3 && inst.getRawBytes()[1] == 0xff &&
+                        inst.getRawBytes()[2] == 0x15) ||
+                    (zydisInst->mnemonic == ZYDIS_MNEMONIC_JMP && inst.size() >= 3 && inst.getRawBytes()[1] == 0xff &&
+                        inst.getRawBytes()[2] == 0x25)
                 )
                 {
                     // is displacement set earlier already?
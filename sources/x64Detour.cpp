@@ -10,6 +10,7 @@
 #include <asmtk/asmtk.h>
 
 #include "polyhook2/Detour/x64Detour.hpp"
+#include "polyhook2/Detour/CodeCaveIndex.hpp"
 #include "polyhook2/MemProtector.hpp"
 #include "polyhook2/Misc.hpp"
 
@@ -21,17 +22,28 @@ namespace PLH
     using namespace asmjit;
 
     x64Detour::x64Detour(const uint64_t fnAddress, const uint64_t fnCallback, uint64_t* userTrampVar) :
-        Detour(fnAddress, fnCallback, userTrampVar, getArchType()), m_allocator(8, 100)
+        Detour(fnAddress, fnCallback, userTrampVar, getArchType())
     {
     }
 
     x64Detour::~x64Detour()
     {
+        if (m_hooked)
+        {
+            unHook();
+        }
+
         if (m_valloc2_region)
         {
-            m_allocator.deallocate(*m_valloc2_region);
+            NearCodeHeap::singleton().deallocate(*m_valloc2_region);
             m_valloc2_region = {};
         }
+
+        if (m_code_cave)
+        {
+            CodeCaveIndex::singleton().release(*m_code_cave, 8);
+            m_code_cave = {};
+        }
     }
 
     Mode x64Detour::getArchType() const
@@ -54,6 +66,11 @@ namespace PLH
         m_detourScheme = scheme;
     }
 
+    uint8_t x64Detour::getChosenScheme() const
+    {
+        return m_chosen_scheme;
+    }
+
     const char* x64Detour::printDetourScheme(detour_scheme_t scheme)
     {
         switch (scheme)
@@ -124,6 +141,60 @@ namespace PLH
             NOP5_RETN, NOP6_RETN, NOP7_RETN, NOP8_RETN, NOP9_RETN, NOP10_RETN, NOP11_RETN
         };
 
+        // one matcher for both lists, OFF1 entries first so list order stays the priority order.
+        // Patterns too short to hold SIZE bytes are dropped, offsets[i] is where the cave starts in match i
+        std::vector<Pattern> compiled;
+        std::vector<uint64_t> offsets;
+        for (const char* pat : PATTERNS_OFF1)
+        {
+            if (getPatternSize(pat) - 1 < SIZE)
+                continue;
+            compiled.emplace_back(pat);
+            offsets.push_back(1);
+        }
+
+        for (const char* pat : PATTERNS_OFF3)
+        {
+            if (getPatternSize(pat) - 3 < SIZE)
+                continue;
+            compiled.emplace_back(pat);
+            offsets.push_back(3);
+        }
+        const MultiPattern patterns(std::move(compiled));
+
+        // claims the best cave of the chunk; when another hook already owns it, the next match in
+        // priority order, nearest to address first, is tried instead of giving up on the chunk
+        const auto claimInChunk = [&](const uint64_t search, const size_t read, const bool below) -> optional<uint64_t>
+        {
+            const auto toCave = [&](const MultiPattern::Match& match)
+            {
+                return search + (match.address + offsets[match.index] - (uint64_t)data);
+            };
+
+            const auto best = below ? patterns.findBest_rev((uint64_t)data, read)
+                                    : patterns.findBest((uint64_t)data, read);
+            if (!best)
+                return {};
+
+            if (CodeCaveIndex::singleton().claim(toCave(*best), SIZE))
+                return toCave(*best);
+
+            auto matches = patterns.findAll((uint64_t)data, read);
+            std::stable_sort(matches.begin(), matches.end(), [below](const auto& a, const auto& b)
+            {
+                if (a.index != b.index)
+                    return a.index < b.index;
+                return below ? a.address > b.address : a.address < b.address;
+            });
+
+            for (const auto& match : matches)
+            {
+                if (CodeCaveIndex::singleton().claim(toCave(match), SIZE))
+                    return toCave(match);
+            }
+            return {};
+        };
+
         // Most common:
         // https://gist.github.com/stevemk14ebr/d117e8d0fd1432fb2a92354a034ce5b9
         // We check for rets to verify it's not like a mid function or jmp table pad
@@ -149,36 +220,9 @@ namespace PLH
                 if (read == 0 || read < SIZE)
                     continue;
 
-                auto finder = [&](const char* pattern, const uint64_t offset) -> optional<uint64_t>
-                {
-                    if (const auto found = findPattern_rev((uint64_t)data, read, pattern))
-                    {
-                        return search + (found + offset - (uint64_t)data);
-                    }
-                    return {};
-                };
-
-                for (const char* pat : PATTERNS_OFF1)
-                {
-                    if (getPatternSize(pat) - 1 < SIZE)
-                        continue;
-
-                    if (auto found = finder(pat, 1))
-                    {
-                        return found;
-                    }
-                }
-
-                for (const char* pat : PATTERNS_OFF3)
-                {
-                    if (getPatternSize(pat) - 3 < SIZE)
-                        continue;
-
-                    if (auto found = finder(pat, 3))
-                    {
-                        return found;
-                    }
-                }
+                // a single pass over the chunk instead of one per pattern
+                if (const auto cave = claimInChunk(search, read, true))
+                    return cave;
             }
         }
 
@@ -197,40 +241,9 @@ namespace PLH
                     continue;
                 }
 
-                auto finder = [&](const char* pattern, const uint64_t offset) -> optional<uint64_t>
-                {
-                    if (const auto found = findPattern((uint64_t)data, read, pattern))
-                    {
-                        return search + (found + offset - (uint64_t)data);
-                    }
-                    return {};
-                };
-
-                for (const char* pat : PATTERNS_OFF1)
-                {
-                    if (getPatternSize(pat) - 1 < SIZE)
-                    {
-                        continue;
-                    }
-
-                    if (auto found = finder(pat, 1))
-                    {
-                        return found;
-                    }
-                }
-
-                for (const char* pat : PATTERNS_OFF3)
-                {
-                    if (getPatternSize(pat) - 3 < SIZE)
-                    {
-                        continue;
-                    }
-
-                    if (auto found = finder(pat, 3))
-                    {
-                        return found;
-                    }
-                }
+                // a single pass over the chunk instead of one per pattern
+                if (const auto cave = claimInChunk(search, read, false))
+                    return cave;
             }
         }
         return {};
@@ -277,19 +290,12 @@ namespace PLH
             const auto max = AlignDownwards(calc_2gb_above(m_fnAddress), getPageSize());
             const auto min = AlignDownwards(calc_2gb_below(m_fnAddress), getPageSize());
 
-            // each block is m_blocksize (8) at the time of writing. Do not write more than this.
-            auto region = (uint64_t)m_allocator.allocate(min, max);
+            // 8 byte destination holder. The heap discards chunks VirtualAlloc2 placed outside the range,
+            // a WINE bug, see: https://github.com/stevemk14ebr/PolyHook_2_0/pull/168
+            const auto region = NearCodeHeap::singleton().allocate(m_fnAddress, 8, min, max);
             if (!region)
             {
                 PLH_LOG("VirtualAlloc2 failed to find a region near function", ErrorLevel::SEV);
-            }
-            else if (region < min || region >= max)
-            {
-                // Workaround for WINE bug, VirtualAlloc2 does not return region in the correct range (always?)
-                // see: https://github.com/stevemk14ebr/PolyHook_2_0/pull/168
-                m_allocator.deallocate(region);
-                region = 0;
-                PLH_LOG("VirtualAlloc2 failed allocate within requested range", ErrorLevel::SEV);
                 // intentionally try other schemes.
             }
             else
@@ -297,7 +303,7 @@ namespace PLH
                 m_valloc2_region = region;
 
                 MemoryProtector region_protector(region, 8, RWX, *this, false);
-                m_hookInsts = makex64MinimumJump(m_fnAddress, m_fnCallback, region);
+                m_hookInsts = makex64MinimumJump(m_fnAddress, getHookDestination(), region);
                 m_chosen_scheme = VALLOC2;
                 return true;
             }
@@ -312,7 +318,7 @@ namespace PLH
             {
                 a.lea(x86::rsp, ptr(x86::rsp, -0x80));
                 a.push(x86::rax);
-                a.mov(x86::rax, m_fnCallback);
+                a.mov(x86::rax, getHookDestination());
                 a.xchg(ptr(x86::rsp), x86::rax);
                 a.ret(0x80);
             });
@@ -328,11 +334,20 @@ namespace PLH
         // We're really space constrained, try to do some stupid hacks like checking for 0xCC's near us
         if (m_detourScheme & CODE_CAVE)
         {
-            const auto cave = findNearestCodeCave<8>(m_fnAddress);
+            // the shared index only scans each address range once, fall back to the slow search if it has nothing
+            auto cave = CodeCaveIndex::singleton().acquire(m_fnAddress, 8, calc_2gb_below(m_fnAddress),
+                                                            calc_2gb_above(m_fnAddress), *this);
+            if (!cave)
+            {
+                // claimed through the index, so neither search hands this cave out again
+                cave = findNearestCodeCave<8>(m_fnAddress);
+            }
+            m_code_cave = cave;
+
             if (cave)
             {
                 MemoryProtector cave_protector(*cave, 8, RWX, *this, false);
-                m_hookInsts = makex64MinimumJump(m_fnAddress, m_fnCallback, *cave);
+                m_hookInsts = makex64MinimumJump(m_fnAddress, getHookDestination(), *cave);
                 m_chosen_scheme = CODE_CAVE;
                 return true;
             }
@@ -346,7 +361,7 @@ namespace PLH
         {
             const auto success = make_inplace_trampoline(m_fnAddress, [&](auto& a)
             {
-                a.mov(x86::rax, m_fnCallback);
+                a.mov(x86::rax, getHookDestination());
                 a.push(x86::rax);
                 a.ret();
             });
@@ -368,7 +383,7 @@ namespace PLH
         return false;
     }
 
-    bool x64Detour::hook()
+    bool x64Detour::prepareHook()
     {
         PLH_LOG("m_fnAddress: " + int_to_hex(m_fnAddress) + "\n", ErrorLevel::INFO);
 
@@ -390,17 +405,28 @@ namespace PLH
         // update given fn address to resolved one
         m_fnAddress = insts.front().getAddress();
 
-        if (!allocate_jump_to_callback())
+        // the cave, holder and trampoline claimed below are given back if any later step fails
+        bool prepared = false;
+        auto release = finally([&]()
+        {
+            if (!prepared)
+            {
+                cancelHook();
+            }
+        });
+
+        if (!prepareStats())
         {
             return false;
         }
 
+        if (!allocate_jump_to_callback())
         {
-            std::stringstream ss;
-            ss << printDetourScheme(m_chosen_scheme);
-            PLH_LOG("Chosen detour scheme: " + ss.str() + "\n", ErrorLevel::INFO);
+            return false;
         }
 
+        PLH_LOG(std::string("Chosen detour scheme: ") + printDetourScheme(m_chosen_scheme) + "\n", ErrorLevel::INFO);
+
         // min size of patches that may split instructions
         // For valloc & code cave, we insert the jump, hence we take only size of the 1st instruction.
         // For detours, we calculate the size of the generated code.
@@ -438,12 +464,11 @@ namespace PLH
         {
             return false;
         }
-        PLH_LOG("m_trampoline: " + int_to_hex(m_trampoline) + "\n", ErrorLevel::INFO);
-        PLH_LOG("m_trampolineSz: " + int_to_hex(m_trampolineSz) + "\n", ErrorLevel::INFO);
+        PLH_LOG_EVENT(LogEvent::Kind::TrampolineBuilt, ErrorLevel::INFO, m_trampoline, m_trampolineSz, m_fnAddress);
 
-        auto tramp_instructions = m_disasm.
-            disassemble(m_trampoline, m_trampoline, m_trampoline + m_trampolineSz, *this);
-        PLH_LOG("Trampoline:\n" + instsToStr(tramp_instructions) + "\n", ErrorLevel::INFO);
+        // only disassembled when someone listens
+        PLH_LOG("Trampoline:\n" + instsToStr(m_disasm.disassemble(m_trampoline, m_trampoline,
+                    m_trampoline + m_trampolineSz, *this)) + "\n", ErrorLevel::INFO);
         if (!jmpTblOpt.empty())
         {
             PLH_LOG("Trampoline Jmp Tbl:\n" + instsToStr(jmpTblOpt) + "\n", ErrorLevel::INFO);
@@ -452,33 +477,32 @@ namespace PLH
         *m_userTrampVar = m_trampoline;
         m_hookSize = static_cast<uint32_t>(roundProlSz);
         m_nopProlOffset = static_cast<uint16_t>(minProlSz);
-
-        PLH_LOG("Hook instructions: \n" + instsToStr(m_hookInsts) + "\n", ErrorLevel::INFO);
-        MemoryProtector prot(m_fnAddress, m_hookSize, RWX, *this);
-        ZydisDisassembler::writeEncoding(m_hookInsts, *this);
-
-        PLH_LOG("Hook size: " + std::to_string(m_hookSize) + "\n", ErrorLevel::INFO);
-        PLH_LOG("Prologue offset: " + std::to_string(m_nopProlOffset) + "\n", ErrorLevel::INFO);
-
-        // Nop the space between jmp and end of prologue
-        assert(m_hookSize >= m_nopProlOffset);
-        m_nopSize = static_cast<uint16_t>(m_hookSize - m_nopProlOffset);
-        const auto nops = make_nops(m_fnAddress + m_nopProlOffset, m_nopSize);
-        ZydisDisassembler::writeEncoding(nops, *this);
-
-        m_hooked = true;
+        PLH_LOG_EVENT(LogEvent::Kind::HookPrepared, ErrorLevel::INFO, m_fnAddress, m_chosen_scheme, m_hookSize);
+        prepared = true;
         return true;
     }
 
-    bool x64Detour::unHook()
+    void x64Detour::cancelHook()
     {
-        const bool status = Detour::unHook();
+        if (m_trampoline != NULL && m_nearTrampoline)
+        {
+            NearCodeHeap::singleton().deallocate(m_trampoline);
+            m_trampoline = NULL;
+        }
+        m_nearTrampoline = false;
+
+        Detour::cancelHook();
         if (m_valloc2_region)
         {
-            m_allocator.deallocate(*m_valloc2_region);
+            NearCodeHeap::singleton().deallocate(*m_valloc2_region);
             m_valloc2_region = {};
         }
-        return status;
+
+        if (m_code_cave)
+        {
+            CodeCaveIndex::singleton().release(*m_code_cave, 8);
+            m_code_cave = {};
+        }
     }
 
     /**
@@ -487,16 +511,24 @@ namespace PLH
      * we also need to store it: `add rax, rbx` && `mov [r15], rax`, where as in cmp instruction for
      * instance there is no such requirement.
      */
-    const static std::set<string> instructions_to_store{
+    const static std::set<ZydisMnemonic> instructions_to_store{
         // NOLINT(cert-err58-cpp)
-        "adc", "add", "and", "bsf", "bsr", "btc", "btr", "bts",
-        "cmovb", "cmove", "cmovl", "cmovle", "cmovnb", "cmovnbe", "cmovnl", "cmovnle",
-        "cmovno", "cmovnp", "cmovns", "cmovnz", "cmovo", "cmovp", "cmovs", "cmovz",
-        "cmpxchg", "crc32", "cvtsi2sd", "cvtsi2ss", "dec", "extractps", "inc", "mov",
-        "neg", "not", "or", "pextrb", "pextrd", "pextrq", "rcl", "rcr", "rol", "ror",
-        "sal", "sar", "sbb", "setb", "setbe", "setl", "setle", "setnb", "setnbe", "setnl",
-        "setnle", "setno", "setnp", "setns", "setnz", "seto", "setp", "sets", "setz", "shl",
-        "shld", "shr", "shrd", "sub", "verr", "verw", "xadd", "xchg", "xor"
+        ZYDIS_MNEMONIC_ADC, ZYDIS_MNEMONIC_ADD, ZYDIS_MNEMONIC_AND, ZYDIS_MNEMONIC_BSF, ZYDIS_MNEMONIC_BSR,
+        ZYDIS_MNEMONIC_BTC, ZYDIS_MNEMONIC_BTR, ZYDIS_MNEMONIC_BTS, ZYDIS_MNEMONIC_CMOVB,
+        ZYDIS_MNEMONIC_CMOVL, ZYDIS_MNEMONIC_CMOVLE, ZYDIS_MNEMONIC_CMOVNB, ZYDIS_MNEMONIC_CMOVNBE,
+        ZYDIS_MNEMONIC_CMOVNL, ZYDIS_MNEMONIC_CMOVNLE, ZYDIS_MNEMONIC_CMOVNO, ZYDIS_MNEMONIC_CMOVNP,
+        ZYDIS_MNEMONIC_CMOVNS, ZYDIS_MNEMONIC_CMOVNZ, ZYDIS_MNEMONIC_CMOVO, ZYDIS_MNEMONIC_CMOVP,
+        ZYDIS_MNEMONIC_CMOVS, ZYDIS_MNEMONIC_CMOVZ, ZYDIS_MNEMONIC_CMPXCHG, ZYDIS_MNEMONIC_CRC32,
+        ZYDIS_MNEMONIC_CVTSI2SD, ZYDIS_MNEMONIC_CVTSI2SS, ZYDIS_MNEMONIC_DEC, ZYDIS_MNEMONIC_EXTRACTPS,
+        ZYDIS_MNEMONIC_INC, ZYDIS_MNEMONIC_MOV, ZYDIS_MNEMONIC_NEG, ZYDIS_MNEMONIC_NOT, ZYDIS_MNEMONIC_OR,
+        ZYDIS_MNEMONIC_PEXTRB, ZYDIS_MNEMONIC_PEXTRD, ZYDIS_MNEMONIC_PEXTRQ, ZYDIS_MNEMONIC_RCL, ZYDIS_MNEMONIC_RCR,
+        ZYDIS_MNEMONIC_ROL, ZYDIS_MNEMONIC_ROR, ZYDIS_MNEMONIC_SAR, ZYDIS_MNEMONIC_SBB,
+        ZYDIS_MNEMONIC_SETB, ZYDIS_MNEMONIC_SETBE, ZYDIS_MNEMONIC_SETL, ZYDIS_MNEMONIC_SETLE, ZYDIS_MNEMONIC_SETNB,
+        ZYDIS_MNEMONIC_SETNBE, ZYDIS_MNEMONIC_SETNL, ZYDIS_MNEMONIC_SETNLE, ZYDIS_MNEMONIC_SETNO,
+        ZYDIS_MNEMONIC_SETNP, ZYDIS_MNEMONIC_SETNS, ZYDIS_MNEMONIC_SETNZ, ZYDIS_MNEMONIC_SETO, ZYDIS_MNEMONIC_SETP,
+        ZYDIS_MNEMONIC_SETS, ZYDIS_MNEMONIC_SETZ, ZYDIS_MNEMONIC_SHL, ZYDIS_MNEMONIC_SHLD, ZYDIS_MNEMONIC_SHR,
+        ZYDIS_MNEMONIC_SHRD, ZYDIS_MNEMONIC_SUB, ZYDIS_MNEMONIC_VERR, ZYDIS_MNEMONIC_VERW, ZYDIS_MNEMONIC_XADD,
+        ZYDIS_MNEMONIC_XCHG, ZYDIS_MNEMONIC_XOR
     };
 
     const static std::map<ZydisRegister, ZydisRegister> a_to_b{
@@ -564,7 +596,7 @@ namespace PLH
             // Only the mov instruction can encode 64-bit immediate, so it is a special case
             scratch_register_string =
                 inst_contains("qword")
-                    ? (instruction.getMnemonic() == "mov" ? "rax" : "eax")
+                    ? (instruction.getMnemonicId() == ZYDIS_MNEMONIC_MOV ? "rax" : "eax")
                     : inst_contains("dword")
                     ? "eax"
                     : inst_contains("word")
@@ -694,7 +726,7 @@ namespace PLH
 
         // ALWAYS: Avoid spoiling the shadow space
         translation.emplace_back("lea rsp, [rsp - 0x80]");
-        if (instruction.getMnemonic() == "lea")
+        if (instruction.getMnemonicId() == ZYDIS_MNEMONIC_LEA)
         {
             // lea rax, ds:[0x00007FFD4FFDC400]
             uint64_t relativeDest = instruction.getRelativeDestination();
@@ -732,7 +764,7 @@ namespace PLH
             translation.emplace_back(translated_instruction);
 
             // Store the scratch register content into the destination, if necessary
-            if (instructions_to_store.contains(instruction.getMnemonic()))
+            if (instructions_to_store.contains(instruction.getMnemonicId()))
             {
                 translation.emplace_back("mov [" + address_register + "], " + scratch_register_64);
             }
@@ -822,15 +854,22 @@ namespace PLH
         // prol + jmp back to prol + N * jmpEntries + align pad
         m_trampolineSz = static_cast<uint16_t>(prolSz + jmp_size * (1 + neededEntryCount) + alignment_pad_size);
 
-        // allocate new trampoline before deleting old to increase odds of new mem address
-        void *tmpTrampoline{}, *rwPtr{};
-        g_asmjit_rt.allocator()->alloc((void**)&m_trampoline, &rwPtr, m_trampolineSz);
-        if (m_trampoline != NULL)
+        // near the prologue rel32 branches and rip relative operands relocate in place, so few instructions
+        // need a jmp table entry or a translation routine. The asmjit heap is the fallback with no such guarantee
+        m_trampoline = NearCodeHeap::singleton().allocate(prolStart, m_trampolineSz);
+        m_nearTrampoline = m_trampoline != NULL;
+        if (!m_nearTrampoline)
         {
-            g_asmjit_rt.allocator()->release((void*)m_trampoline);
+            void *rxPtr{}, *rwPtr{};
+            g_asmjit_rt.allocator()->alloc(&rxPtr, &rwPtr, m_trampolineSz);
+            m_trampoline = (uint64_t)rxPtr;
         }
 
-        m_trampoline = (uint64_t)tmpTrampoline;
+        if (m_trampoline == NULL)
+        {
+            PLH_LOG("Failed to allocate trampoline", ErrorLevel::SEV);
+            return false;
+        }
         delta = m_trampoline - prolStart;
 
         buildRelocationList(prologue, prolSz, delta, instsNeedingEntry, instsNeedingReloc, instsNeedingTranslation);
@@ -848,8 +887,6 @@ namespace PLH
                     ErrorLevel::INFO);
         }
 
-        PLH_LOG("Trampoline address: " + int_to_hex(m_trampoline), ErrorLevel::INFO);
-
         for (auto& instruction : instsNeedingTranslation)
         {
             const auto inst_offset = instruction.getAddress() - prolStart;
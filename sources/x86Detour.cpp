@@ -22,7 +22,7 @@ namespace PLH
         return 5;
     }
 
-    bool x86Detour::hook()
+    bool x86Detour::prepareHook()
     {
         PLH_LOG("m_fnAddress: " + int_to_hex(m_fnAddress) + "\n", ErrorLevel::INFO);
 
@@ -46,6 +46,11 @@ namespace PLH
 
         // --------------- END RECURSIVE JMP RESOLUTION ---------------------
 
+        if (!prepareStats())
+        {
+            return false;
+        }
+
         uint64_t minProlSz = getJmpSize(); // min size of patches that may split instructions
         uint64_t roundProlSz = minProlSz; // nearest size to min that doesn't split any instructions
 
@@ -76,9 +81,11 @@ namespace PLH
             return false;
         }
 
-        auto tramp_instructions = m_disasm.
-            disassemble(m_trampoline, m_trampoline, m_trampoline + m_trampolineSz, *this);
-        PLH_LOG("Trampoline:\n" + instsToStr(tramp_instructions) + "\n\n", ErrorLevel::INFO);
+        PLH_LOG_EVENT(LogEvent::Kind::TrampolineBuilt, ErrorLevel::INFO, m_trampoline, m_trampolineSz, m_fnAddress);
+
+        // only disassembled when someone listens
+        PLH_LOG("Trampoline:\n" + instsToStr(m_disasm.disassemble(m_trampoline, m_trampoline,
+                    m_trampoline + m_trampolineSz, *this)) + "\n\n", ErrorLevel::INFO);
         if (!jmpTblOpt.empty())
         {
             PLH_LOG("Trampoline Jmp Tbl:\n" + instsToStr(jmpTblOpt) + "\n\n", ErrorLevel::INFO);
@@ -88,19 +95,8 @@ namespace PLH
         m_hookSize = static_cast<uint32_t>(roundProlSz);
         m_nopProlOffset = static_cast<uint16_t>(minProlSz);
 
-        MemoryProtector prot(m_fnAddress, m_hookSize, RWX, *this);
-
-        m_hookInsts = makex86Jmp(m_fnAddress, m_fnCallback);
-        PLH_LOG("Hook instructions:\n" + instsToStr(m_hookInsts) + "\n", ErrorLevel::INFO);
-        ZydisDisassembler::writeEncoding(m_hookInsts, *this);
-
-        // Nop the space between jmp and end of prologue
-        assert(m_hookSize >= m_nopProlOffset);
-        m_nopSize = static_cast<uint16_t>(m_hookSize - m_nopProlOffset);
-        const auto nops = make_nops(m_fnAddress + m_nopProlOffset, m_nopSize);
-        ZydisDisassembler::writeEncoding(nops, *this);
-
-        m_hooked = true;
+        m_hookInsts = makex86Jmp(m_fnAddress, getHookDestination());
+        PLH_LOG_EVENT(LogEvent::Kind::HookPrepared, ErrorLevel::INFO, m_fnAddress, 0, m_hookSize);
         return true;
     }
 